@@ -1,5 +1,7 @@
 local action = _ACTION or ''
 
+newoption { trigger = "trace", description = "Build liblowpix with trace spans (LP_TRACE_ENABLE)" }
+
 flags { "Unicode", "C++11" }
 exceptionhandling "Off"
 rtti "Off"
@@ -84,7 +86,24 @@ workspace "lowpix"
         language "C"
 
         includedirs { "src/liblowpix/include" }
-        files { "src/liblowpix/include/**.h", "src/liblowpix/src/**.c" }
+        files { "src/liblowpix/include/**.h", "src/liblowpix/src/**.h", "src/liblowpix/src/**.c" }
+
+        filter "options:trace"
+            defines { "LP_TRACE_ENABLE" }
+        filter {}
+
+    project "lowpixc"
+        kind "ConsoleApp"
+        language "C"
+        targetdir("build/bin")
+
+        links { "liblowpix", "lua" }
+
+        includedirs { "src/lowpix/include", "src/liblowpix/include", "src-lib/lua" }
+        files { "src/lowpixc/**.h", "src/lowpixc/**.c", "src/lowpix/include/parg.h", "src/lowpix/src/parg.c" }
+
+        filter "system:linux"
+            links { "pthread", "dl", "m" }
 
     project "lowpix"
         kind "WindowedApp"
@@ -103,7 +122,7 @@ workspace "lowpix"
             links { "opengl32" }
 
         filter "system:linux"
-            links { "X11", "Xrandr", "rt", "GL", "GLU", "pthread", "dl", "Xinerama", "Xcursor" }
+            links { "X11", "Xrandr", "rt", "GL", "GLU", "pthread", "dl", "m", "Xinerama", "Xcursor" }
 
         filter "system:macosx"
             linkoptions { "-framework OpenGL", "-framework Cocoa", "-framework IOKit" }
@@ -9,17 +9,47 @@ extern "C" {
 #endif
 
 
+#define LP_VERSION "0.2.1"
 #define LP_ALIGN(x, a) (void*)(((uintptr_t)(x) + (a) - (uintptr_t)1) & ~((a) - (uintptr_t)1))
 #define LP_MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define LP_MAX(a, b) (((a) > (b)) ? (a) : (b))
 
 // MEM
 // define LP_ALLOC_CUSTOM to override with your own
 extern void* lp_alloc(void* ptr, size_t nsize);
 extern void* lp_zalloc(size_t size); // init mem to 0
 
+// ARENA - bump allocator freed all at once, one thread at a time
+// while an arena is bound to a thread lp_alloc takes new memory from it, so everything a job allocates
+// (palettes, images, codec output) goes away with one reset; pointers from elsewhere keep using the heap.
+// Arena memory may be realloc'd or freed with lp_alloc only while its arena is bound, freeing is a no-op
+// except for the most recent allocation. Binding has no effect with LP_ALLOC_CUSTOM.
+struct LPArena;
+extern struct LPArena* lp_arena_new(size_t block_size); // 0 for 64KB blocks, larger allocations get their own
+extern void lp_arena_free(struct LPArena* a);
+extern void* lp_arena_alloc(struct LPArena* a, size_t size); // 16 byte aligned
+extern size_t lp_arena_mark(struct LPArena* a);
+extern void lp_arena_rewind(struct LPArena* a, size_t mark); // frees everything allocated since mark
+extern void lp_arena_reset(struct LPArena* a); // frees everything, keeps the blocks for reuse
+extern size_t lp_arena_used(struct LPArena* a);
+extern struct LPArena* lp_arena_bind(struct LPArena* a); // for the calling thread, 0 unbinds; returns the previous one to restore
+extern struct LPArena* lp_scratch(void); // per thread arena for temporaries, use with mark/rewind
+
 struct LPFileMap { void* mem; uint64_t size; };
-extern struct LPFileMap* lp_mmap(const char* filename);
+enum LPMapFlags
+{
+	LP_MAP_READ = 0,
+	LP_MAP_WRITE = 1,       // shared and writable, the file is created or grown to at least offset + size bytes
+	LP_MAP_SEQUENTIAL = 2,  // read ahead aggressively and drop pages behind
+	LP_MAP_WILLNEED = 4,    // start reading the range in the background
+	LP_MAP_POPULATE = 8,    // fault the whole range in before returning
+};
+extern struct LPFileMap* lp_mmap(const char* filename); // whole file, read only
+extern struct LPFileMap* lp_mmap_ex(const char* filename, uint64_t offset, uint64_t size, uint32_t flags); // size 0 reads to the end
 extern void lp_munmap(struct LPFileMap* fmap);
+// unmaps, write maps are cut to offset + size (the bytes actually written), ranged ones never below the size
+// the file had before; 0 if flushing or resizing failed
+extern int lp_munmap_size(struct LPFileMap* fmap, uint64_t size);
 
 static inline uint16_t lp_read_u16_le(void* p)
 { uint8_t* s = (uint8_t*)p; uint16_t v = s[0] | s[1]<<8; return v; }
@@ -36,6 +66,68 @@ static inline uint32_t lp_read_u32_be(void* p)
 { uint8_t* s = (uint8_t*)p; uint32_t v = s[0]<<24 | s[1]<<16 | s[2]<<8 | s[3]; return v; }
 
 
+// WRITER - buffered output with hand rolled formatting, to a file or to a growing memory buffer
+struct LPWriter { uint8_t* buf; size_t pos, cap; void* f; /* FILE*, 0 for memory */ int error; };
+extern struct LPWriter* lp_w_open(const char* fn); // 0 if the file can't be created
+extern struct LPWriter* lp_w_mem(void);
+extern void lp_w_reserve(struct LPWriter* w, size_t sz); // room for sz more bytes at buf + pos
+extern void lp_w_write(struct LPWriter* w, const void* data, size_t sz);
+extern void lp_w_str(struct LPWriter* w, const char* s);
+extern void lp_w_hex(struct LPWriter* w, uint32_t v, int digits); // uppercase, zero padded to digits
+extern void lp_w_dec(struct LPWriter* w, int64_t v, int width); // space padded to width
+static inline void lp_w_putc(struct LPWriter* w, char c)
+{ if (w->pos == w->cap) lp_w_reserve(w, 1); w->buf[w->pos++] = (uint8_t)c; }
+extern int lp_w_close(struct LPWriter* w); // flushes and frees, returns 0 if any write failed
+extern void* lp_w_close_mem(struct LPWriter* w, size_t* sz); // returns the data of a memory writer, free with lp_alloc(p, 0)
+// gcc -MD -MP style dependency file: targets depend on deps, each dep also gets an empty rule
+extern int lp_dep_save(const char* fn, const char* const* targets, uint32_t target_count, const char* const* deps, uint32_t dep_count);
+
+// MEM TRACKING - off by default and one branch per lp_alloc when off, needs the built in lp_alloc.
+// Counts lp_alloc calls per call site (arena served ones too) and follows live heap blocks (arena blocks
+// included), blocks allocated while tracking was off are ignored when freed
+struct LPMemStats
+{
+	uint64_t calls, bytes;  // lp_alloc calls that allocated or resized, bytes they asked for
+	uint64_t frees;         // tracked heap blocks freed
+	uint64_t current, peak; // live heap bytes
+	uint64_t live;          // live heap blocks, leaks if nonzero at shutdown
+	uint64_t hist[48];      // calls by size, [i] counts sizes in [2^(i-1), 2^i)
+};
+extern void lp_mem_track(int enable); // turning it on clears previous data, off keeps it for reports
+extern void lp_mem_stats(struct LPMemStats* stats);
+// totals, size histogram, max_sites call sites by heap peak (0 for all) and live blocks by site
+extern void lp_mem_report(struct LPWriter* w, uint32_t max_sites);
+
+
+// THREAD
+extern uint32_t lp_thread_count(void); // hardware threads, or fewer when capped
+// caps the threads lp_parallel_for uses at once, 0 for all hardware threads; the pool itself is sized for the
+// hardware so a count above that doesn't add any
+extern void lp_thread_set_count(uint32_t count);
+extern uint64_t lp_time_ns(void); // monotonic clock
+// calls fn for every ix in [0, count) from as many threads as useful, returns when all calls are done
+extern void lp_parallel_for(uint32_t count, void (*fn)(void* user, uint32_t ix), void* user);
+// the same, slot is below lp_thread_count() and no two calls running at once share one, for state kept per thread
+extern void lp_parallel_for_slot(uint32_t count, void (*fn)(void* user, uint32_t ix, uint32_t slot), void* user);
+// jobs group tasks run by the shared work stealing pool (started on first use, a worker per hardware thread
+// besides the waiting one, at least one), tasks can submit and wait on jobs themselves; submitting never
+// runs the task in the caller, only waiting does
+struct LPJob;
+extern struct LPJob* lp_job_new(void);
+extern void lp_job_submit(struct LPJob* job, void (*fn)(void* user, uint32_t ix), void* user, uint32_t ix);
+extern void lp_job_for(struct LPJob* job, uint32_t count, void (*fn)(void* user, uint32_t ix), void* user); // one task per ix
+extern void lp_job_cancel(struct LPJob* job); // tasks not started yet are skipped
+extern int lp_job_cancelled(struct LPJob* job); // for long tasks to stop early
+extern int lp_job_done(struct LPJob* job);
+extern int lp_job_wait(struct LPJob* job); // runs pool tasks until the job is done, frees it, 0 if it was cancelled
+
+
+// TRACE - spans around codecs, palette loads and saves, file mappings and their inner phases as Chrome trace
+// JSON, for builds with LP_TRACE_ENABLE defined (premake --trace); recording is off until enabled
+extern int lp_trace_enable(int on); // 0 if tracing isn't compiled in
+extern int lp_trace_save(const char* fn); // every span recorded so far by any thread, 0 on failure or without tracing
+
+
 // CODEC
 extern void* lp_cod_rle(void* data, size_t* data_sz);
 extern void* lp_dec_rle(void* data, size_t* data_sz);
@@ -43,6 +135,53 @@ extern void* lp_cod_huf4(void* data, size_t* data_sz);
 extern void* lp_cod_huf8(void* data, size_t* data_sz);
 extern void* lp_cod_lz77(void* data, size_t* data_sz);
 extern void* lp_dec_lz77(void* data, size_t* data_sz);
+// the same into a caller buffer (a LP_MAP_WRITE mapping of the output file for instance), return the size written,
+// 0 if dst_cap is below lp_cod_bound (encoders) or lp_dec_size (decoders) or the data can't be converted
+extern size_t lp_cod_bound(size_t data_sz); // largest output of any encoder for data_sz bytes
+extern size_t lp_dec_size(void* data, size_t data_sz); // decoded size from the header, 0 if it isn't one of ours
+extern size_t lp_cod_rle_to(void* data, size_t data_sz, void* dst, size_t dst_cap);
+extern size_t lp_dec_rle_to(void* data, size_t data_sz, void* dst, size_t dst_cap);
+extern size_t lp_cod_huf4_to(void* data, size_t data_sz, void* dst, size_t dst_cap);
+extern size_t lp_cod_huf8_to(void* data, size_t data_sz, void* dst, size_t dst_cap);
+extern size_t lp_cod_lz77_to(void* data, size_t data_sz, void* dst, size_t dst_cap);
+extern size_t lp_dec_lz77_to(void* data, size_t data_sz, void* dst, size_t dst_cap);
+
+
+// CACHE - persistent results of conversions in a directory, keyed by a hash of the input, parameters and LP_VERSION
+struct LPCache;
+extern uint64_t lp_hash64(const void* data, size_t sz, uint64_t seed); // xxhash64
+extern uint64_t lp_cache_key(const char* fn, const void* params, size_t params_sz); // 0 if fn can't be read
+extern uint64_t lp_cache_key_mem(const void* data, size_t sz, const void* params, size_t params_sz);
+extern struct LPCache* lp_cache_open(const char* dir, uint64_t max_size); // max_size in bytes, 0 for no limit
+extern void* lp_cache_get(struct LPCache* c, uint64_t key, size_t* sz); // 0 if missing, free with lp_alloc(p, 0)
+extern int lp_cache_get_file(struct LPCache* c, uint64_t key, const char* fn); // copies the entry to fn, 0 if missing
+extern int lp_cache_put(struct LPCache* c, uint64_t key, const void* data, size_t sz);
+extern int lp_cache_put_file(struct LPCache* c, uint64_t key, const char* fn);
+extern void lp_cache_close(struct LPCache* c); // evicts least recently used entries beyond max_size and saves the index
+// the same without closing, for a process keeping c open (not while other threads use it), skipped if c wasn't
+// used since the last save; 0 if the index couldn't be written
+extern int lp_cache_save(struct LPCache* c);
+// any lp_cod_* through the cache, codec names it in the key; c can be 0
+extern void* lp_cod_cached(struct LPCache* c, const char* codec, void* (*cod)(void* data, size_t* data_sz), void* data, size_t* data_sz);
+
+
+// WATCH - reports files changed on disk (inotify on linux, size and time polling elsewhere), once they've been
+// quiet for debounce_ms so a file written in several steps is reported once
+struct LPWatch;
+extern struct LPWatch* lp_watch_new(uint32_t debounce_ms);
+extern void lp_watch_free(struct LPWatch* w);
+extern int lp_watch_add(struct LPWatch* w, const char* fn); // the file doesn't have to exist yet
+extern void lp_watch_remove(struct LPWatch* w, const char* fn);
+// waits up to timeout_ms for changes, fills changed with up to max paths (valid until the file is removed), returns the count
+extern uint32_t lp_watch_poll(struct LPWatch* w, uint32_t timeout_ms, const char** changed, uint32_t max);
+// ms until lp_watch_poll can report what it has already seen (a quiet period ending) or scans again, 0 if inotify has
+// unread events, ~0u when only a new change can; a loop sleeping between polls sleeps at most that long
+extern uint32_t lp_watch_next(struct LPWatch* w);
+// blocks up to timeout_ms (~0u: no limit) until inotify has events for lp_watch_poll to read, returns 1 if so, 0 on timeout,
+// -1 without inotify (nothing to wait on, lp_watch_next covers scans); unlike the rest it can run on another thread
+extern int lp_watch_wait(struct LPWatch* w, uint32_t timeout_ms);
+// size and modification time in ns of fn, the stamp lp_watch compares; returns 0 if fn doesn't exist
+extern int lp_file_stamp(const char* fn, uint64_t* size, uint64_t* time);
 
 
 // PALETTE
@@ -54,19 +193,85 @@ enum LPPaletteFormat
 	LP_PALETTEFORMAT_GPL,		// for Gimp
 	LP_PALETTEFORMAT_ASM,		// .s/.h for GBA in 5-5-5 bpp
 	LP_PALETTEFORMAT_C,			// GBA 5-5-5 bpp C file used both as header and compilation unit (define <palettename>_IMPLEMENTATION to compile data)
+	LP_PALETTEFORMAT_ELF,		// .o/.h GBA 5-5-5 bpp data in a relocatable ARM ELF object, same header as ASM
 };
 struct LPPalette { uint32_t col_count; uint32_t col[1]; /* overallocated */ };
 extern uint16_t lp_col5(uint32_t col);
 extern uint32_t lp_col8(uint16_t col);
+// bulk versions, identical results (SSE2 when the build enables it)
+extern void lp_col5_n(uint16_t* dst, const uint32_t* src, size_t n);
+extern void lp_col8_n(uint32_t* dst, const uint16_t* src, size_t n);
 extern uint32_t lp_colf(float r, float g, float b);
 extern uint32_t lp_col_lerp(uint32_t col1, uint32_t col2, float x);
 extern int lp_pal_save(struct LPPalette* pal, const char* fn, enum LPPaletteFormat format);
+// lp_pal_save plus <fn>.d listing fn (and its .h) as depending on deps (source images, palettes, parameter files)
+extern int lp_pal_save_dep(struct LPPalette* pal, const char* fn, enum LPPaletteFormat format, const char* const* deps, uint32_t dep_count);
+// name is the symbol name for source formats, wh receives the companion header of formats that have one (can be 0)
+extern int lp_pal_write(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name, enum LPPaletteFormat format);
+// lp_pal_write to memory, h and h_sz are optional; free results with lp_alloc(p, 0)
+extern void* lp_pal_save_mem(struct LPPalette* pal, const char* name, enum LPPaletteFormat format, size_t* sz, void** h, size_t* h_sz);
 extern struct LPPalette* lp_pal_load(const char* fn, void* data, size_t sz);
 extern struct LPPalette* lp_pal_clone(struct LPPalette* pal);
 extern struct LPPalette* lp_pal_concat(struct LPPalette* pal1, struct LPPalette* pal2);
 extern struct LPPalette* lp_pal_unique(struct LPPalette* pal);
 extern struct LPPalette* lp_pal_restrict(struct LPPalette* pal);
 extern struct LPPalette* lp_pal_lerp(struct LPPalette* pal1, struct LPPalette* pal2, float x);
+// tables of step_count palettes one after the other, ready to export in a single lp_pal_save
+// fade in RGB555 fixed point from pal1 (first step) to pal2 (last step), or to col if pal2 is 0 (black/white fades)
+extern struct LPPalette* lp_pal_fade(struct LPPalette* pal1, struct LPPalette* pal2, uint32_t col, uint32_t step_count);
+// color cycling, each step rotates entries [first, first+count) by one more entry
+extern struct LPPalette* lp_pal_cycle(struct LPPalette* pal, uint32_t first, uint32_t count, uint32_t step_count);
+
+// BANKS - pack tile color sets into the fewest sub-palettes (4bpp GBA backgrounds: 16 banks of 16 colors)
+enum LPBankFlags
+{
+	LP_BANK_TRANSPARENT	= 1<<0,	// entry 0 of every bank is the transparent color, which is removed from tile color sets
+	LP_BANK_EXHAUSTIVE	= 1<<1,	// branch and bound search after the heuristics, bounded in time
+};
+struct LPBanks
+{
+	uint32_t bank_count, bank_size, tile_count;
+	uint32_t* tile_bank;	// bank index of each tile
+	struct LPPalette* pal;	// bank_count * bank_size colors, unused entries are 0
+};
+// tiles are color sets (order and duplicates don't matter, alpha ignored); returns 0 if a tile doesn't fit in a bank
+// result is a single allocation, free with lp_alloc(banks, 0)
+extern struct LPBanks* lp_pal_banks(struct LPPalette** tiles, uint32_t tile_count, uint32_t bank_size, uint32_t flags, uint32_t transparent);
+
+
+// COLOR SPACES
+enum LPColorMetric
+{
+	LP_METRIC_RGB = 0,	// euclidean on 8 bit sRGB channels
+	LP_METRIC_CIE76,	// CIELAB (D65) delta E 1976
+	LP_METRIC_CIE94,	// CIELAB delta E 1994, graphic arts weights
+	LP_METRIC_OKLAB,	// euclidean in OKLab
+};
+extern void lp_col_oklab(uint32_t col, float lab[3]);
+extern void lp_col_cielab(uint32_t col, float lab[3]);
+extern float lp_col_dist(uint32_t col1, uint32_t col2, enum LPColorMetric metric); // delta E, exact float math
+// RGB555 -> 32768*3 floats in the metric's space (0 for LP_METRIC_RGB), built once on first use
+extern const float* lp_col_table(enum LPColorMetric metric);
+extern float lp_col5_dist2(uint16_t col1, uint16_t col2, enum LPColorMetric metric); // squared delta E from the tables
+
+
+// IMAGE
+struct LPImage { uint32_t w, h; uint32_t pix[1]; /* overallocated, same color layout as palettes */ };
+extern struct LPImage* lp_img_new(uint32_t w, uint32_t h); // cleared to 0
+extern struct LPImage* lp_img_clone(struct LPImage* img);
+extern struct LPImage* lp_img_load(const char* fn, void* data, size_t sz); // bmp and tga, uncompressed or tga rle
+enum LPDither
+{
+	LP_DITHER_NONE = 0,		// nearest color
+	LP_DITHER_FLOYD,		// Floyd-Steinberg error diffusion
+	LP_DITHER_ATKINSON,		// Atkinson error diffusion, loses 1/4 of the error for more contrast
+	LP_DITHER_BAYER4,		// ordered 4x4
+	LP_DITHER_BAYER8,		// ordered 8x8
+};
+// returns w*h indices into the first 256 colors of pal, matching is done in RGB555 with the given metric
+extern uint8_t* lp_img_remap(struct LPImage* img, struct LPPalette* pal, enum LPDither dither, enum LPColorMetric metric);
+// lookup tables of recent palettes are kept for the next remaps, this frees them (before lp_mem_report, at exit)
+extern void lp_remap_flush(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,390 @@
+#include <stddef.h>
+#include <string.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * SUB-PALETTE BANKS
+ *
+ * Packing tile color sets into as few banks as possible is a bin packing
+ * problem on sets (colors shared by tiles only cost once per bank).
+ * Several heuristic orderings are evaluated in parallel and the best one
+ * is kept, then an optional branch and bound search tries to beat it.
+ *************************************************************************/
+
+#define LP_BANK_COLMAX      (256)       // largest supported bank
+#define LP_BANK_CANDIDATES  (16)        // heuristic orderings evaluated
+#define LP_BANK_SEARCH_MAX  (1 << 21)   // node budget of the exhaustive search, split between tasks
+#define LP_BANK_TASKS_MIN   (32)        // frontier size splitting the exhaustive search
+
+struct LPBankCtx
+{
+	uint32_t cap;                   // usable colors per bank
+	uint32_t tile_count;
+	uint32_t* tile_ofs;             // tile t colors: tile_col[tile_ofs[t] .. +tile_n[t]]
+	uint32_t* tile_n;
+	uint32_t* tile_col;
+	uint8_t* dominated;             // tile set is a subset of another one
+	uint32_t set_count;             // maximal sets, largest first
+	uint32_t* set;                  // tile index of each maximal set
+	uint32_t col_total;             // distinct colors in all tiles, for the lower bound
+	uint32_t* order[LP_BANK_CANDIDATES];
+	uint32_t* banks[LP_BANK_CANDIDATES]; // (cap+1) words per bank, word 0 is the count
+	uint32_t bank_count[LP_BANK_CANDIDATES];
+	// exhaustive search
+	uint32_t best;
+	uint32_t task_count, task_depth;
+	uint32_t* task_prefix;          // task_depth bank indices per task
+	uint32_t* task_assign;          // set_count bank indices per task, best found
+	uint32_t* task_found;           // bank count found per task, 0 if none
+	uint32_t* final_n;              // color count of each resulting bank
+};
+
+static int lp_bank_cmp_u32(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+static uint32_t lp_bank_union_count(const uint32_t* a, uint32_t an, const uint32_t* b, uint32_t bn)
+{
+	uint32_t i = 0, j = 0, n = 0;
+	while (i < an && j < bn) { if (a[i] < b[j]) ++i; else if (a[i] > b[j]) ++j; else ++i, ++j; ++n; }
+	return n + (an - i) + (bn - j);
+}
+static uint32_t lp_bank_union(uint32_t* dst, const uint32_t* a, uint32_t an, const uint32_t* b, uint32_t bn)
+{
+	uint32_t i = 0, j = 0, n = 0;
+	while (i < an && j < bn) { if (a[i] < b[j]) dst[n++] = a[i++]; else if (a[i] > b[j]) dst[n++] = b[j++]; else dst[n++] = a[i++], ++j; }
+	while (i < an) dst[n++] = a[i++];
+	while (j < bn) dst[n++] = b[j++];
+	return n;
+}
+static int lp_bank_subset(const uint32_t* a, uint32_t an, const uint32_t* b, uint32_t bn)
+{
+	uint32_t i = 0, j = 0;
+	if (an > bn) return 0;
+	while (i < an && j < bn) { if (a[i] == b[j]) ++i, ++j; else if (a[i] > b[j]) ++j; else return 0; }
+	return i == an;
+}
+// merge set into bank (word 0 is the count)
+static void lp_bank_add(uint32_t* bank, const uint32_t* s, uint32_t sn)
+{
+	uint32_t tmp[LP_BANK_COLMAX];
+	bank[0] = lp_bank_union(tmp, bank + 1, bank[0], s, sn);
+	memcpy(bank + 1, tmp, bank[0] * sizeof(*tmp));
+}
+
+static void lp_bank_tile_normalize(void* user, uint32_t t)
+{
+	struct LPBankCtx* ctx = user;
+	uint32_t* c = ctx->tile_col + ctx->tile_ofs[t], n = ctx->tile_n[t], u = 0;
+	qsort(c, n, sizeof(*c), lp_bank_cmp_u32);
+	for (uint32_t i = 0; i < n; ++i) if (u == 0 || c[i] != c[u-1]) c[u++] = c[i];
+	ctx->tile_n[t] = u;
+}
+static void lp_bank_tile_dominated(void* user, uint32_t t)
+{
+	struct LPBankCtx* ctx = user;
+	const uint32_t *a = ctx->tile_col + ctx->tile_ofs[t], an = ctx->tile_n[t];
+	for (uint32_t j = 0; j < ctx->tile_count; ++j)
+	{
+		uint32_t bn = ctx->tile_n[j];
+		if (j == t || bn < an || (bn == an && j > t)) continue; // equal sets: the first one is kept
+		if (lp_bank_subset(a, an, ctx->tile_col + ctx->tile_ofs[j], bn)) { ctx->dominated[t] = 1; return; }
+	}
+}
+
+// best fit: each set goes to the bank gaining the fewest colors, then banks are merged while they fit
+static void lp_bank_candidate(void* user, uint32_t c)
+{
+	struct LPBankCtx* ctx = user;
+	uint32_t cap = ctx->cap, stride = cap + 1, bc = 0, *banks = ctx->banks[c];
+	for (uint32_t k = 0; k < ctx->set_count; ++k)
+	{
+		uint32_t t = ctx->set[ctx->order[c][k]];
+		const uint32_t *s = ctx->tile_col + ctx->tile_ofs[t], sn = ctx->tile_n[t];
+		uint32_t best_b = bc, best_add = cap + 1;
+		for (uint32_t b = 0; b < bc && best_add > 0; ++b)
+		{
+			uint32_t* bank = banks + b*stride;
+			uint32_t u = lp_bank_union_count(bank + 1, bank[0], s, sn);
+			if (u <= cap && u - bank[0] < best_add) best_b = b, best_add = u - bank[0];
+		}
+		if (best_b == bc) banks[bc++*stride] = 0;
+		lp_bank_add(banks + best_b*stride, s, sn);
+	}
+	for (int merged = 1; merged;)
+	{
+		merged = 0;
+		for (uint32_t a = 0; a < bc; ++a)
+			for (uint32_t b = a + 1; b < bc; ++b)
+			{
+				uint32_t *ba = banks + a*stride, *bb = banks + b*stride;
+				if (lp_bank_union_count(ba + 1, ba[0], bb + 1, bb[0]) > cap) continue;
+				lp_bank_add(ba, bb + 1, bb[0]);
+				if (b != --bc) memcpy(bb, banks + bc*stride, stride * sizeof(*banks)); // last bank moves into the hole
+				merged = 1, --b;
+			}
+	}
+	ctx->bank_count[c] = bc;
+}
+
+/* Exhaustive search **************************************************
+sets are assigned largest first to an existing bank or to one new bank,
+any partial assignment using as many banks as the best known is pruned.
+The first task_depth levels are expanded up front into independent tasks.
+*/
+struct LPBankSearch
+{
+	struct LPBankCtx* ctx;
+	uint32_t* banks;    // (cap+1) words per bank
+	uint32_t* undo;     // (cap+1) words per depth
+	uint32_t* assign;   // bank index per set
+	uint32_t nodes, nodes_max;
+	uint32_t task;
+};
+static void lp_bank_search_best(struct LPBankSearch* bs, uint32_t bc)
+{
+	uint32_t best, *found = bs->ctx->task_found + bs->task;
+	while (bc < (best = lp_atomic_load(&bs->ctx->best)) && !lp_atomic_cas(&bs->ctx->best, best, bc));
+	if (*found == 0 || bc < *found)
+	{
+		*found = bc;
+		memcpy(bs->ctx->task_assign + bs->task*bs->ctx->set_count, bs->assign, bs->ctx->set_count * sizeof(*bs->assign));
+	}
+}
+static void lp_bank_search_rec(struct LPBankSearch* bs, uint32_t k, uint32_t bc)
+{
+	struct LPBankCtx* ctx = bs->ctx;
+	uint32_t cap = ctx->cap, stride = cap + 1, lower = (ctx->col_total + cap - 1) / cap;
+	if (bc >= lp_atomic_load(&ctx->best) || ++bs->nodes > bs->nodes_max) return;
+	if (k == ctx->set_count) { lp_bank_search_best(bs, bc); return; }
+	if (lp_atomic_load(&ctx->best) <= lower) return; // optimal already
+	uint32_t t = ctx->set[k];
+	const uint32_t *s = ctx->tile_col + ctx->tile_ofs[t], sn = ctx->tile_n[t];
+	uint32_t* undo = bs->undo + k*stride;
+	for (uint32_t b = 0; b <= bc && b < ctx->set_count; ++b)
+	{
+		uint32_t* bank = bs->banks + b*stride;
+		if (b == bc) bank[0] = 0;
+		else if (lp_bank_union_count(bank + 1, bank[0], s, sn) > cap) continue;
+		memcpy(undo, bank, stride * sizeof(*bank));
+		lp_bank_add(bank, s, sn);
+		bs->assign[k] = b;
+		lp_bank_search_rec(bs, k + 1, b == bc ? bc + 1 : bc);
+		memcpy(bank, undo, stride * sizeof(*bank));
+	}
+}
+static void lp_bank_search_task(void* user, uint32_t task)
+{
+	struct LPBankCtx* ctx = user;
+	uint32_t cap = ctx->cap, stride = cap + 1, bc = 0, n = ctx->set_count;
+	uint32_t* mem = lp_alloc(0, (stride*n*2 + n) * sizeof(*mem));
+	struct LPBankSearch bs = { ctx, mem, mem + stride*n, mem + stride*n*2, 0, LP_BANK_SEARCH_MAX / ctx->task_count, task };
+	const uint32_t* prefix = ctx->task_prefix + task*ctx->task_depth;
+	for (uint32_t k = 0; k < ctx->task_depth; ++k)
+	{
+		uint32_t t = ctx->set[k], b = prefix[k];
+		uint32_t* bank = bs.banks + b*stride;
+		if (b == bc) bank[0] = 0, ++bc;
+		lp_bank_add(bank, ctx->tile_col + ctx->tile_ofs[t], ctx->tile_n[t]);
+		bs.assign[k] = b;
+	}
+	lp_bank_search_rec(&bs, ctx->task_depth, bc);
+	lp_alloc(mem, 0);
+}
+// breadth first expansion of the search tree, without capacity checks beyond the prefix validity
+static int lp_bank_search_prefix_valid(struct LPBankCtx* ctx, const uint32_t* prefix, uint32_t depth)
+{
+	uint32_t cap = ctx->cap, bc = 0;
+	uint32_t* banks = lp_alloc(0, (cap + 1) * depth * sizeof(*banks));
+	int ok = 1;
+	for (uint32_t k = 0; k < depth && ok; ++k)
+	{
+		uint32_t t = ctx->set[k], b = prefix[k], *bank = banks + b*(cap + 1);
+		if (b == bc) bank[0] = 0, ++bc;
+		ok = lp_bank_union_count(bank + 1, bank[0], ctx->tile_col + ctx->tile_ofs[t], ctx->tile_n[t]) <= cap;
+		if (ok) lp_bank_add(bank, ctx->tile_col + ctx->tile_ofs[t], ctx->tile_n[t]);
+	}
+	lp_alloc(banks, 0);
+	return ok;
+}
+static void lp_bank_search(struct LPBankCtx* ctx)
+{
+	uint32_t n = ctx->set_count, depth = 1, count = 1;
+	uint32_t* prefix = lp_zalloc(sizeof(*prefix)); // set 0 always opens bank 0
+	while (count < LP_BANK_TASKS_MIN && depth < n)
+	{
+		uint32_t* next = lp_alloc(0, count * (depth + 1) * (depth + 1) * sizeof(*next)), next_count = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const uint32_t* p = prefix + i*depth;
+			uint32_t bc = 0;
+			for (uint32_t k = 0; k < depth; ++k) if (p[k] + 1 > bc) bc = p[k] + 1;
+			for (uint32_t b = 0; b <= bc; ++b)
+			{
+				uint32_t* q = next + next_count*(depth + 1);
+				memcpy(q, p, depth * sizeof(*q)); q[depth] = b;
+				if (lp_bank_search_prefix_valid(ctx, q, depth + 1)) ++next_count;
+			}
+		}
+		lp_alloc(prefix, 0);
+		prefix = next, count = next_count, ++depth;
+	}
+	ctx->task_count = count, ctx->task_depth = depth, ctx->task_prefix = prefix;
+	ctx->task_assign = lp_alloc(0, count * n * sizeof(*ctx->task_assign));
+	ctx->task_found = lp_zalloc(count * sizeof(*ctx->task_found));
+	lp_parallel_for(count, lp_bank_search_task, ctx);
+}
+
+static void lp_bank_tile_assign(void* user, uint32_t t)
+{
+	void** u = user;
+	struct LPBankCtx* ctx = u[0];
+	struct LPBanks* res = u[1];
+	const uint32_t *s = ctx->tile_col + ctx->tile_ofs[t], sn = ctx->tile_n[t];
+	uint32_t first = res->bank_size - ctx->cap;
+	for (uint32_t b = 0; b < res->bank_count; ++b)
+	{
+		const uint32_t* bank = res->pal->col + b*res->bank_size + first;
+		if (lp_bank_subset(s, sn, bank, ctx->final_n[b])) { res->tile_bank[t] = b; return; }
+	}
+}
+
+struct LPBanks* lp_pal_banks(struct LPPalette** tiles, uint32_t tile_count, uint32_t bank_size, uint32_t flags, uint32_t transparent)
+{
+	if (!tiles || tile_count == 0 || bank_size == 0 || bank_size > LP_BANK_COLMAX) return 0;
+	struct LPBankCtx ctx = { 0 };
+	struct LPBanks* res = 0;
+	uint32_t t, k, c, total = 0;
+	transparent &= 0xFFFFFF;
+	ctx.cap = flags & LP_BANK_TRANSPARENT ? bank_size - 1 : bank_size;
+	ctx.tile_count = tile_count;
+	if (ctx.cap == 0) return 0;
+	LP_TRACE_BEGIN(trace);
+
+	// sorted unique color sets per tile, alpha ignored, transparent color dropped
+	ctx.tile_ofs = lp_alloc(0, tile_count * sizeof(*ctx.tile_ofs));
+	ctx.tile_n = lp_alloc(0, tile_count * sizeof(*ctx.tile_n));
+	for (t = 0; t < tile_count; ++t) ctx.tile_ofs[t] = total, total += tiles[t]->col_count;
+	ctx.tile_col = lp_alloc(0, (total ? total : 1) * sizeof(*ctx.tile_col));
+	for (t = 0; t < tile_count; ++t)
+	{
+		uint32_t* dst = ctx.tile_col + ctx.tile_ofs[t];
+		ctx.tile_n[t] = 0;
+		for (c = 0; c < tiles[t]->col_count; ++c)
+		{
+			uint32_t col = tiles[t]->col[c] & 0xFFFFFF;
+			if (!(flags & LP_BANK_TRANSPARENT) || col != transparent) dst[ctx.tile_n[t]++] = col;
+		}
+	}
+	lp_parallel_for(tile_count, lp_bank_tile_normalize, &ctx);
+	for (t = 0; t < tile_count; ++t) if (ctx.tile_n[t] > ctx.cap) goto done;
+	{
+		uint32_t* all = lp_alloc(0, (total ? total : 1) * sizeof(*all)), n = 0;
+		for (t = 0; t < tile_count; ++t) memcpy(all + n, ctx.tile_col + ctx.tile_ofs[t], ctx.tile_n[t] * sizeof(*all)), n += ctx.tile_n[t];
+		qsort(all, n, sizeof(*all), lp_bank_cmp_u32);
+		for (c = 0; c < n; ++c) if (c == 0 || all[c] != all[c-1]) ++ctx.col_total;
+		lp_alloc(all, 0);
+	}
+
+	// only maximal sets matter, subsets follow the bank of their superset
+	ctx.dominated = lp_zalloc(tile_count);
+	lp_parallel_for(tile_count, lp_bank_tile_dominated, &ctx);
+	ctx.set = lp_alloc(0, tile_count * sizeof(*ctx.set));
+	for (t = 0; t < tile_count; ++t) if (!ctx.dominated[t] && ctx.tile_n[t]) ctx.set[ctx.set_count++] = t;
+	for (k = 1; k < ctx.set_count; ++k) // stable insertion sort, largest first
+	{
+		uint32_t s = ctx.set[k], j = k;
+		for (; j > 0 && ctx.tile_n[ctx.set[j-1]] < ctx.tile_n[s]; --j) ctx.set[j] = ctx.set[j-1];
+		ctx.set[j] = s;
+	}
+
+	// heuristic candidates: size order, color popularity order, then randomly perturbed size orders
+	uint32_t cand = ctx.set_count ? LP_BANK_CANDIDATES : 0, best_c = 0;
+	uint32_t* pop = lp_zalloc((ctx.set_count ? ctx.set_count : 1) * sizeof(*pop));
+	for (k = 0; k < ctx.set_count; ++k)
+		for (uint32_t j = 0; j < ctx.set_count; ++j)
+		{
+			uint32_t a = ctx.set[k], b = ctx.set[j];
+			pop[k] += ctx.tile_n[a] + ctx.tile_n[b] - lp_bank_union_count(ctx.tile_col + ctx.tile_ofs[a], ctx.tile_n[a], ctx.tile_col + ctx.tile_ofs[b], ctx.tile_n[b]);
+		}
+	for (c = 0; c < cand; ++c)
+	{
+		uint32_t* o = ctx.order[c] = lp_alloc(0, ctx.set_count * sizeof(*o)), rnd = 0x9E3779B9u * (c + 1);
+		for (k = 0; k < ctx.set_count; ++k) o[k] = k;
+		if (c == 1) for (k = 1; k < ctx.set_count; ++k)
+		{
+			uint32_t s = o[k], j = k;
+			for (; j > 0 && pop[o[j-1]] < pop[s]; --j) o[j] = o[j-1];
+			o[j] = s;
+		}
+		else if (c > 1) for (k = 1; k < ctx.set_count; ++k)
+		{
+			rnd ^= rnd << 13, rnd ^= rnd >> 17, rnd ^= rnd << 5;
+			if (rnd & 1) { uint32_t s = o[k]; o[k] = o[k-1]; o[k-1] = s; }
+		}
+		ctx.banks[c] = lp_alloc(0, ctx.set_count * (ctx.cap + 1) * sizeof(*ctx.banks[c]));
+	}
+	lp_alloc(pop, 0);
+	LP_TRACE_BEGIN(trace_cand);
+	lp_parallel_for(cand, lp_bank_candidate, &ctx);
+	LP_TRACE_END(trace_cand, "bank candidates");
+	for (c = 1; c < cand; ++c) if (ctx.bank_count[c] < ctx.bank_count[best_c]) best_c = c;
+
+	uint32_t bank_count = cand ? ctx.bank_count[best_c] : 0, best_task = 0;
+	if ((flags & LP_BANK_EXHAUSTIVE) && bank_count > 1)
+	{
+		ctx.best = bank_count;
+		LP_TRACE_BEGIN(trace_search);
+		lp_bank_search(&ctx);
+		LP_TRACE_END(trace_search, "bank search");
+		for (k = 0; k < ctx.task_count; ++k)
+			if (ctx.task_found[k] && ctx.task_found[k] < bank_count) bank_count = ctx.task_found[k], best_task = k + 1;
+	}
+
+	// result in a single block: header, tile bank indices, palette
+	size_t pal_ofs = (size_t)(uintptr_t)LP_ALIGN(sizeof(*res) + tile_count * sizeof(*res->tile_bank), 8);
+	res = lp_alloc(0, pal_ofs + offsetof(struct LPPalette, col[bank_count ? bank_count * bank_size : 1]));
+	res->bank_count = bank_count, res->bank_size = bank_size, res->tile_count = tile_count;
+	res->tile_bank = (uint32_t*)(res + 1);
+	res->pal = (struct LPPalette*)((uint8_t*)res + pal_ofs);
+	res->pal->col_count = bank_count * bank_size;
+	memset(res->pal->col, 0, bank_count * bank_size * sizeof(*res->pal->col));
+	ctx.final_n = lp_alloc(0, (bank_count ? bank_count : 1) * sizeof(*ctx.final_n));
+	for (uint32_t b = 0; b < bank_count; ++b)
+	{
+		uint32_t* dst = res->pal->col + b*bank_size;
+		if (flags & LP_BANK_TRANSPARENT) *dst++ = transparent;
+		if (best_task)
+		{
+			uint32_t bank[LP_BANK_COLMAX], bn = 0;
+			const uint32_t* assign = ctx.task_assign + (best_task - 1)*ctx.set_count;
+			for (k = 0; k < ctx.set_count; ++k)
+			{
+				if (assign[k] != b) continue;
+				uint32_t tmp[LP_BANK_COLMAX], s = ctx.set[k];
+				bn = lp_bank_union(tmp, bank, bn, ctx.tile_col + ctx.tile_ofs[s], ctx.tile_n[s]);
+				memcpy(bank, tmp, bn * sizeof(*bank));
+			}
+			memcpy(dst, bank, bn * sizeof(*dst));
+			ctx.final_n[b] = bn;
+		}
+		else
+		{
+			const uint32_t* bank = ctx.banks[best_c] + b*(ctx.cap + 1);
+			memcpy(dst, bank + 1, bank[0] * sizeof(*dst));
+			ctx.final_n[b] = bank[0];
+		}
+	}
+	memset(res->tile_bank, 0, tile_count * sizeof(*res->tile_bank));
+	void* assign_user[2] = { &ctx, res };
+	lp_parallel_for(tile_count, lp_bank_tile_assign, assign_user);
+
+done:
+	for (c = 0; c < LP_BANK_CANDIDATES; ++c) { lp_alloc(ctx.order[c], 0); lp_alloc(ctx.banks[c], 0); }
+	lp_alloc(ctx.task_prefix, 0); lp_alloc(ctx.task_assign, 0); lp_alloc(ctx.task_found, 0); lp_alloc(ctx.final_n, 0);
+	lp_alloc(ctx.set, 0); lp_alloc(ctx.dominated, 0);
+	lp_alloc(ctx.tile_col, 0); lp_alloc(ctx.tile_n, 0); lp_alloc(ctx.tile_ofs, 0);
+	LP_TRACE_END(trace, "lp_pal_banks");
+	return res;
+}
@@ -0,0 +1,278 @@
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * CACHE
+ *
+ * One file per entry named after its 64 bit key, plus an index file
+ * holding a fixed layout header and entry array so it can be mapped
+ * and copied in one go. Files are written to a temporary name then
+ * renamed, so concurrent builds sharing a directory never see partial
+ * entries; the index is merged with the one on disk when saving, on
+ * close or by lp_cache_save for a process that keeps it open.
+ * LRU uses a logical clock bumped on every get/put.
+ *************************************************************************/
+
+#define LP_CACHE_MAGIC      (0x4943504C) // LPCI
+#define LP_CACHE_PATH_MAX   (1024)
+#define LP_CACHE_DIR_MAX    (LP_CACHE_PATH_MAX - 32) // room for the entry names, sized so snprintf can't cut them
+#define LP_CACHE_TMP_MAX    (LP_CACHE_PATH_MAX + 48)
+
+struct LPCacheEntry { uint64_t key, size, last_use; };
+struct LPCacheIndex { uint32_t magic, entry_size; uint64_t count, clock; struct LPCacheEntry entry[1]; /* overallocated */ };
+struct LPCache
+{
+	char dir[LP_CACHE_DIR_MAX];
+	uint64_t max_size, clock, saved;    // saved: clock when the index was last written
+	uint32_t lock;
+	size_t count, cap;
+	struct LPCacheEntry* entry;     // sorted by key
+};
+
+// xxhash64
+#define LP_P1 (0x9E3779B185EBCA87ull)
+#define LP_P2 (0xC2B2AE3D27D4EB4Full)
+#define LP_P3 (0x165667B19E3779F9ull)
+#define LP_P4 (0x85EBCA77C2B2AE63ull)
+#define LP_P5 (0x27D4EB2F165667C5ull)
+static uint64_t lp_rotl64(uint64_t v, int r) { return v << r | v >> (64 - r); }
+static uint64_t lp_read_u64_le(const uint8_t* s) { return (uint64_t)lp_read_u32_le((void*)s) | (uint64_t)lp_read_u32_le((void*)(s + 4)) << 32; }
+static uint64_t lp_hash_round(uint64_t acc, uint64_t v) { return lp_rotl64(acc + v * LP_P2, 31) * LP_P1; }
+static uint64_t lp_hash_merge(uint64_t h, uint64_t v) { return (h ^ lp_hash_round(0, v)) * LP_P1 + LP_P4; }
+uint64_t lp_hash64(const void* data, size_t sz, uint64_t seed)
+{
+	const uint8_t *p = data, *e = p + sz;
+	uint64_t h;
+	if (sz >= 32)
+	{
+		uint64_t v1 = seed + LP_P1 + LP_P2, v2 = seed + LP_P2, v3 = seed, v4 = seed - LP_P1;
+		for (; p + 32 <= e; p += 32)
+		{
+			v1 = lp_hash_round(v1, lp_read_u64_le(p)), v2 = lp_hash_round(v2, lp_read_u64_le(p + 8));
+			v3 = lp_hash_round(v3, lp_read_u64_le(p + 16)), v4 = lp_hash_round(v4, lp_read_u64_le(p + 24));
+		}
+		h = lp_rotl64(v1, 1) + lp_rotl64(v2, 7) + lp_rotl64(v3, 12) + lp_rotl64(v4, 18);
+		h = lp_hash_merge(lp_hash_merge(lp_hash_merge(lp_hash_merge(h, v1), v2), v3), v4);
+	}
+	else h = seed + LP_P5;
+	h += (uint64_t)sz;
+	for (; p + 8 <= e; p += 8) h = lp_rotl64(h ^ lp_hash_round(0, lp_read_u64_le(p)), 27) * LP_P1 + LP_P4;
+	if (p + 4 <= e) h = lp_rotl64(h ^ (uint64_t)lp_read_u32_le((void*)p) * LP_P1, 23) * LP_P2 + LP_P3, p += 4;
+	for (; p < e; ++p) h = lp_rotl64(h ^ *p * LP_P5, 11) * LP_P1;
+	h ^= h >> 33; h *= LP_P2; h ^= h >> 29; h *= LP_P3; h ^= h >> 32;
+	return h;
+}
+
+uint64_t lp_cache_key_mem(const void* data, size_t sz, const void* params, size_t params_sz)
+{
+	uint64_t h = lp_hash64(LP_VERSION, sizeof(LP_VERSION), 0);
+	h = lp_hash64(params, params ? params_sz : 0, h);
+	return lp_hash64(data, sz, h);
+}
+uint64_t lp_cache_key(const char* fn, const void* params, size_t params_sz)
+{
+	struct LPFileMap* fm = lp_mmap(fn); if (!fm) return 0;
+	uint64_t h = lp_cache_key_mem(fm->mem, (size_t)fm->size, params, params_sz);
+	lp_munmap(fm);
+	return h;
+}
+
+static void lp_cache_lock(struct LPCache* c) { while (!lp_atomic_cas(&c->lock, 0, 1)) lp_thread_yield(); }
+static void lp_cache_unlock(struct LPCache* c) { lp_atomic_store(&c->lock, 0); }
+static void lp_cache_path(struct LPCache* c, char* path, uint64_t key)
+{ snprintf(path, LP_CACHE_PATH_MAX, "%s/%08X%08X", c->dir, (uint32_t)(key >> 32), (uint32_t)key); }
+static int lp_cache_rename(const char* from, const char* to)
+{
+#ifdef WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+// temporary name next to path, unique per process and call
+static uint32_t lp_cache_tmp_count = 0;
+static void lp_cache_tmp(char tmp[LP_CACHE_TMP_MAX], const char* path)
+{
+#ifdef WIN32
+	unsigned long pid = GetCurrentProcessId();
+#else
+	unsigned long pid = (unsigned long)getpid();
+#endif
+	snprintf(tmp, LP_CACHE_TMP_MAX, "%s.%lu.%u.tmp", path, pid, lp_atomic_add(&lp_cache_tmp_count, 1));
+}
+// lower bound of key in the sorted entries
+static size_t lp_cache_find(struct LPCacheEntry* e, size_t count, uint64_t key)
+{
+	size_t lo = 0, hi = count;
+	while (lo < hi) { size_t mid = (lo + hi) / 2; if (e[mid].key < key) lo = mid + 1; else hi = mid; }
+	return lo;
+}
+static void lp_cache_insert(struct LPCache* c, struct LPCacheEntry en)
+{
+	size_t i = lp_cache_find(c->entry, c->count, en.key);
+	if (i < c->count && c->entry[i].key == en.key)
+	{
+		if (en.last_use > c->entry[i].last_use) c->entry[i] = en;
+		return;
+	}
+	if (c->count == c->cap) c->cap = c->cap ? c->cap * 2 : 256, c->entry = lp_heap_alloc(c->entry, c->cap * sizeof(*c->entry));
+	memmove(c->entry + i + 1, c->entry + i, (c->count - i) * sizeof(*c->entry));
+	c->entry[i] = en, ++c->count;
+}
+// merges the index on disk into c, keeping the most recent use of each entry
+static void lp_cache_load_index(struct LPCache* c)
+{
+	char path[LP_CACHE_PATH_MAX];
+	snprintf(path, sizeof(path), "%s/index", c->dir);
+	struct LPFileMap* fm = lp_mmap(path); if (!fm) return;
+	const struct LPCacheIndex* idx = fm->mem;
+	if (fm->size >= offsetof(struct LPCacheIndex, entry) && idx->magic == LP_CACHE_MAGIC && idx->entry_size == sizeof(struct LPCacheEntry)
+		&& idx->count <= (fm->size - offsetof(struct LPCacheIndex, entry)) / sizeof(struct LPCacheEntry))
+	{
+		for (uint64_t i = 0; i < idx->count; ++i) lp_cache_insert(c, idx->entry[i]);
+		if (idx->clock > c->clock) c->clock = idx->clock;
+	}
+	lp_munmap(fm);
+}
+
+struct LPCache* lp_cache_open(const char* dir, uint64_t max_size)
+{
+	if (!dir || strlen(dir) >= LP_CACHE_DIR_MAX) return 0;
+#ifdef WIN32
+	CreateDirectoryA(dir, NULL);
+#else
+	mkdir(dir, 0777);
+#endif
+	struct LPCache* c = memset(lp_heap_alloc(0, sizeof(*c)), 0, sizeof(*c)); // outlives the jobs using it
+	strcpy(c->dir, dir);
+	c->max_size = max_size;
+	lp_cache_load_index(c);
+	c->saved = c->clock;
+	return c;
+}
+
+void* lp_cache_get(struct LPCache* c, uint64_t key, size_t* sz)
+{
+	char path[LP_CACHE_PATH_MAX];
+	lp_cache_path(c, path, key);
+	struct LPFileMap* fm = lp_mmap(path); if (!fm) return 0;
+	void* data = lp_alloc(0, fm->size ? (size_t)fm->size : 1);
+	memcpy(data, fm->mem, (size_t)fm->size);
+	if (sz) *sz = (size_t)fm->size;
+	lp_cache_lock(c);
+	lp_cache_insert(c, (struct LPCacheEntry){ key, fm->size, ++c->clock });
+	lp_cache_unlock(c);
+	lp_munmap(fm);
+	return data;
+}
+int lp_cache_get_file(struct LPCache* c, uint64_t key, const char* fn)
+{
+	char path[LP_CACHE_PATH_MAX];
+	lp_cache_path(c, path, key);
+	struct LPFileMap* fm = lp_mmap(path); if (!fm) return 0;
+	struct LPWriter* w = lp_w_open(fn);
+	if (w) lp_w_write(w, fm->mem, (size_t)fm->size);
+	int ok = lp_w_close(w);
+	if (ok)
+	{
+		lp_cache_lock(c);
+		lp_cache_insert(c, (struct LPCacheEntry){ key, fm->size, ++c->clock });
+		lp_cache_unlock(c);
+	}
+	lp_munmap(fm);
+	return ok;
+}
+
+int lp_cache_put(struct LPCache* c, uint64_t key, const void* data, size_t sz)
+{
+	char path[LP_CACHE_PATH_MAX], tmp[LP_CACHE_TMP_MAX];
+	lp_cache_path(c, path, key);
+	lp_cache_tmp(tmp, path);
+	struct LPWriter* w = lp_w_open(tmp); if (!w) return 0;
+	lp_w_write(w, data, sz);
+	if (!lp_w_close(w) || !lp_cache_rename(tmp, path)) { remove(tmp); return 0; }
+	lp_cache_lock(c);
+	lp_cache_insert(c, (struct LPCacheEntry){ key, sz, ++c->clock });
+	lp_cache_unlock(c);
+	return 1;
+}
+int lp_cache_put_file(struct LPCache* c, uint64_t key, const char* fn)
+{
+	struct LPFileMap* fm = lp_mmap(fn); if (!fm) return 0;
+	int ok = lp_cache_put(c, key, fm->mem, (size_t)fm->size);
+	lp_munmap(fm);
+	return ok;
+}
+
+static int lp_cache_cmp_use(const void* a, const void* b)
+{
+	uint64_t ua = ((const struct LPCacheEntry*)a)->last_use, ub = ((const struct LPCacheEntry*)b)->last_use;
+	return ua < ub ? 1 : ua > ub ? -1 : 0;
+}
+static int lp_cache_cmp_key(const void* a, const void* b)
+{
+	uint64_t ka = ((const struct LPCacheEntry*)a)->key, kb = ((const struct LPCacheEntry*)b)->key;
+	return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+static int lp_cache_write(struct LPCache* c)
+{
+	char path[LP_CACHE_PATH_MAX], tmp[LP_CACHE_TMP_MAX];
+	lp_cache_load_index(c); // other processes may have added entries since open
+	if (c->max_size)
+	{
+		// keep the most recently used entries that fit, delete the others
+		qsort(c->entry, c->count, sizeof(*c->entry), lp_cache_cmp_use);
+		uint64_t total = 0;
+		size_t keep = 0;
+		for (size_t i = 0; i < c->count; ++i)
+		{
+			if (total + c->entry[i].size <= c->max_size) total += c->entry[i].size, c->entry[keep++] = c->entry[i];
+			else lp_cache_path(c, path, c->entry[i].key), remove(path);
+		}
+		c->count = keep;
+		qsort(c->entry, c->count, sizeof(*c->entry), lp_cache_cmp_key);
+	}
+	snprintf(path, sizeof(path), "%s/index", c->dir);
+	lp_cache_tmp(tmp, path);
+	struct LPWriter* w = lp_w_open(tmp);
+	if (!w) return 0;
+	struct LPCacheIndex hdr = { LP_CACHE_MAGIC, sizeof(struct LPCacheEntry), c->count, c->clock, { { 0, 0, 0 } } };
+	lp_w_write(w, &hdr, offsetof(struct LPCacheIndex, entry));
+	lp_w_write(w, c->entry, c->count * sizeof(*c->entry));
+	if (!lp_w_close(w) || !lp_cache_rename(tmp, path)) { remove(tmp); return 0; }
+	c->saved = c->clock;
+	return 1;
+}
+int lp_cache_save(struct LPCache* c) { return !c || c->clock == c->saved || lp_cache_write(c); }
+void lp_cache_close(struct LPCache* c)
+{
+	if (!c) return;
+	lp_cache_write(c);
+	lp_heap_alloc(c->entry, 0);
+	lp_heap_alloc(c, 0);
+}
+
+void* lp_cod_cached(struct LPCache* c, const char* codec, void* (*cod)(void* data, size_t* data_sz), void* data, size_t* data_sz)
+{
+	if (!c) return cod(data, data_sz);
+	if (!data || !data_sz) return 0;
+	LP_TRACE_BEGIN(trace);
+	uint64_t key = lp_cache_key_mem(data, *data_sz, codec, strlen(codec));
+	size_t sz;
+	void* out = lp_cache_get(c, key, &sz);
+	LP_TRACE_END(trace, "cache lookup");
+	if (out) { *data_sz = sz; return out; }
+	out = cod(data, data_sz);
+	if (out) lp_cache_put(c, key, out, *data_sz);
+	return out;
+}
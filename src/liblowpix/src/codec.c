@@ -1,5 +1,5 @@
 #include <string.h>
-#include "lowpix.h"
+#include "lowpix_i.h"
 
 enum
 {
@@ -12,25 +12,46 @@ enum
 	LP_CODEC_DIFF16		= 0x82,
 };
 
+// encoders stay below this: rle adds a byte per 128, lz77 a flag byte per 8, huffman never exceeds the input plus its table
+size_t lp_cod_bound(size_t data_sz) { return data_sz + data_sz / 8 + 528; }
+size_t lp_dec_size(void* data, size_t data_sz)
+{
+	if (!data || data_sz < 4) return 0;
+	uint32_t header = lp_read_u32_le(data);
+	uint8_t type = (uint8_t)header;
+	return type == LP_CODEC_LZ77 || type == LP_CODEC_HUFF4 || type == LP_CODEC_HUFF8 || type == LP_CODEC_RLE ? header >> 8 : 0;
+}
+// the allocating versions convert into a buffer of the largest size and shrink it to the result
+static void* lp_cod_alloc(void* data, size_t* data_sz, size_t cap, size_t (*to)(void* data, size_t data_sz, void* dst, size_t dst_cap))
+{
+	if (!data || !data_sz || *data_sz == 0 || cap == 0) return 0;
+	void* dst = lp_alloc(0, cap);
+	size_t sz = to(data, *data_sz, dst, cap);
+	if (!sz) { lp_alloc(dst, 0); return 0; }
+	*data_sz = sz;
+	return lp_alloc(dst, sz);
+}
+
 /*************************************************************************
  * RLE - taken from GRIT
  *************************************************************************/
 
-void* lp_cod_rle(void* data, size_t* data_sz)
+size_t lp_cod_rle_to(void* data, size_t data_sz, void* dst_buf, size_t dst_cap)
 {
-	if (!data || !data_sz || *data_sz <= 0) return 0;
+	if (!data || data_sz == 0 || !dst_buf || dst_cap < lp_cod_bound(data_sz)) return 0;
+	LP_TRACE_BEGIN(trace);
 	uint32_t ii, rle, non;
 	uint8_t curr, prev;
 
-	uint32_t srcS = (uint32_t)*data_sz;
+	uint32_t srcS = (uint32_t)data_sz;
 	uint8_t *srcD = data;
 
 	// Annoyingly enough, rle _can_ end up being larger than
 	// the original. A checker-board will do it for example.
 	// if srcS is the size of the alternating pattern, then
 	// the endresult will be 4 + srcS + (srcS+0x80-1)/0x80.
-	uint32_t dstS = 8 + 2 * (srcS);
-	uint8_t *dstD = (uint8_t*)lp_alloc(0, dstS), *dstL = dstD;
+	// lp_cod_bound covers that, the stream is written straight after the header
+	uint8_t *dst = dst_buf, *dstD = dst + 4, *dstL = dstD;
 
 	prev = srcD[0];
 	rle = non = 1;
@@ -80,32 +101,30 @@ void* lp_cod_rle(void* data, size_t* data_sz)
 		prev = curr;
 	}
 
-	dstS = (uint32_t)(uintptr_t)LP_ALIGN(dstL - dstD, 4) + 4;
-
-	uint8_t* dst = lp_alloc(0, dstS);
+	memset(dstL, 0, 3); // deterministic alignment padding
+	uint32_t dstS = (uint32_t)(uintptr_t)LP_ALIGN(dstL - dstD, 4) + 4;
 
 	dst[0] = LP_CODEC_RLE;
 	dst[1] = (srcS >> 0) & 0xFF;
 	dst[2] = (srcS >> 8) & 0xFF;
 	dst[3] = (srcS >> 16) & 0xFF;
 
-	memcpy(dst + 4, dstD, dstS - 4);
-	lp_alloc(dstD, 0);
-
-	*data_sz = dstS;
-	return dst;
+	LP_TRACE_END(trace, "lp_cod_rle");
+	return dstS;
 }
+void* lp_cod_rle(void* data, size_t* data_sz) { return lp_cod_alloc(data, data_sz, data_sz ? lp_cod_bound(*data_sz) : 0, lp_cod_rle_to); }
 
-void* lp_dec_rle(void* data, size_t* data_sz)
+size_t lp_dec_rle_to(void* data, size_t data_sz, void* dst, size_t dst_cap)
 {
-	if (!data || !data_sz || *data_sz <= 0) return 0;
+	if (!data || data_sz < 4 || !dst) return 0;
 
 	// Get and check header word
 	uint32_t header = lp_read_u32_lep(&data);
-	if ((uint8_t)header != LP_CODEC_RLE) return 0;
+	if ((uint8_t)header != LP_CODEC_RLE || (header >> 8) > dst_cap) return 0;
+	LP_TRACE_BEGIN(trace);
 
 	uint32_t ii, dstS = header >> 8, size = 0;
-	uint8_t *srcL = data, *dstD = (uint8_t*)lp_alloc(0, dstS);
+	uint8_t *srcL = data, *dstD = dst;
 
 	for (ii = 0; ii < dstS; ii += size)
 	{
@@ -125,9 +144,10 @@ void* lp_dec_rle(void* data, size_t* data_sz)
 		}
 	}
 
-	*data_sz = dstS;
-	return dstD;
-} 
+	LP_TRACE_END(trace, "lp_dec_rle");
+	return dstS;
+}
+void* lp_dec_rle(void* data, size_t* data_sz) { return lp_cod_alloc(data, data_sz, data_sz ? lp_dec_size(data, *data_sz) : 0, lp_dec_rle_to); }
 
 /*************************************************************************
  * HUFFMAN - taken from GRIT
@@ -203,12 +223,13 @@ static void lp_cod_huff_table_fill(struct LPCodecHuff* ctx, int id, int tier)
 }
 
 //! Main Huffman routine
-static void* lp_cod_huff(void* data, size_t* data_sz, int srcB)
+static size_t lp_cod_huff_to(void* data, size_t data_sz, void* dst_buf, size_t dst_cap, int srcB)
 {
-	if (!data || !data_sz || *data_sz <= 0) return 0;
+	if (!data || data_sz == 0 || !dst_buf || dst_cap < lp_cod_bound(data_sz)) return 0;
+	LP_TRACE_BEGIN(trace_tree);
 	int ii, jj, kk;
 	int nch = 1 << srcB, nodes = 2 * nch - 1;
-	int srcS = (int)*data_sz;
+	int srcS = (int)data_sz;
 
 	// build frequency table and used id list
 	struct LPCodecHuff ctx = { 0 };
@@ -287,7 +308,10 @@ static void* lp_cod_huff(void* data, size_t* data_sz, int srcB)
 		}
 		codes[ii] = code;
 		if (jj >= 32)		// codes are too long, FAIL!
+		{
+			LP_TRACE_END(trace_tree, "huff tree");
 			return 0;
+		}
 		lens[ii] = jj;
 
 		// tier tracker:
@@ -311,14 +335,17 @@ static void* lp_cod_huff(void* data, size_t* data_sz, int srcB)
 	memset(table, -1, 512);
 
 	lp_cod_huff_table_fill(&ctx, nids, 0);
+	LP_TRACE_END(trace_tree, "huff tree");
 
 	// --- Encode the source data ---
+	LP_TRACE_BEGIN(trace_encode);
 
-	int dstS = srcS * 2;
+	// straight after the table, which makes the words unaligned in general
+	int dstS = 0;
 	uint32_t mask = nch - 1;
 
-	uint8_t *dstD = (uint8_t*)lp_alloc(0, dstS);
-	uint32_t *srcL4 = (uint32_t*)data, *dstL4 = (uint32_t*)dstD;
+	uint8_t *dst = dst_buf, *dstD = dst + 5 + ctx.gtiers[maxlen], *dstL = dstD;
+	uint32_t *srcL4 = (uint32_t*)data;
 	uint32_t buf, chunk = 0;
 	int nn = srcS / 4, mm = 32 / srcB, len = 32;
 
@@ -332,7 +359,7 @@ static void* lp_cod_huff(void* data, size_t* data_sz, int srcB)
 			if (len < 0)	// goto new uint32_t
 			{
 				chunk |= codes[kk] >> (-len);
-				*dstL4++ = chunk;
+				memcpy(dstL, &chunk, 4), dstL += 4;
 				len += 32;
 				chunk = codes[kk] << len;
 				dstS += 4;
@@ -343,16 +370,17 @@ static void* lp_cod_huff(void* data, size_t* data_sz, int srcB)
 	}
 	// don't forget the rest
 	if (len != 32)
-		*dstL4++ = chunk;
-	dstS = (int)((uint8_t*)dstL4 - (uint8_t*)dstD);
+		memcpy(dstL, &chunk, 4), dstL += 4;
+	dstS = (int)(dstL - dstD);
+	LP_TRACE_END(trace_encode, "huff encode");
 
 	// --- put everything together ---
 	// full size: header (4) + table size (1) + table (gtiers[maxlen]) + dstS
 
 	len = ctx.gtiers[maxlen];
 	dstS = 5 + len + dstS;
+	memset(dstL, 0, (uintptr_t)LP_ALIGN(dstS, 4) - dstS); // deterministic alignment padding
 	dstS = (int)(uintptr_t)LP_ALIGN(dstS, 4);
-	uint8_t* dst = lp_alloc(0, dstS);
 
 	dst[0] = LP_CODEC_HUFF | srcB;
 	dst[1] = (srcS >> 0) & 0xFF;
@@ -361,14 +389,25 @@ static void* lp_cod_huff(void* data, size_t* data_sz, int srcB)
 
 	dst[4] = (len - 1) / 2;
 	memcpy(&dst[5], ctx.gtable, len);
-	memcpy(&dst[5 + len], dstD, dstS - len - 5);
-	lp_alloc(dstD, 0);
 
-	*data_sz = dstS;
-	return dst;
+	return (size_t)dstS;
+}
+size_t lp_cod_huf4_to(void* data, size_t data_sz, void* dst, size_t dst_cap)
+{
+	LP_TRACE_BEGIN(trace);
+	size_t sz = lp_cod_huff_to(data, data_sz, dst, dst_cap, 4);
+	LP_TRACE_END(trace, "lp_cod_huf4");
+	return sz;
 }
-void* lp_cod_huf4(void* data, size_t* data_sz) { return lp_cod_huff(data, data_sz, 4); }
-void* lp_cod_huf8(void* data, size_t* data_sz) { return lp_cod_huff(data, data_sz, 8); }
+size_t lp_cod_huf8_to(void* data, size_t data_sz, void* dst, size_t dst_cap)
+{
+	LP_TRACE_BEGIN(trace);
+	size_t sz = lp_cod_huff_to(data, data_sz, dst, dst_cap, 8);
+	LP_TRACE_END(trace, "lp_cod_huf8");
+	return sz;
+}
+void* lp_cod_huf4(void* data, size_t* data_sz) { return lp_cod_alloc(data, data_sz, data_sz ? lp_cod_bound(*data_sz) : 0, lp_cod_huf4_to); }
+void* lp_cod_huf8(void* data, size_t* data_sz) { return lp_cod_alloc(data, data_sz, data_sz ? lp_cod_bound(*data_sz) : 0, lp_cod_huf8_to); }
 
 
 /*************************************************************************
@@ -549,17 +588,18 @@ static int lp_cod_lz77_inchar(struct LPCodecLZ77* ctx)
 	return (ctx->InOffset < ctx->InSize) ? ctx->InBuf[ctx->InOffset++] : -1;
 }
 
-void* lp_dec_lz77(void* data, size_t* data_sz)
+size_t lp_dec_lz77_to(void* data, size_t data_sz, void* dst, size_t dst_cap)
 {
-	if (!data || !data_sz || *data_sz <= 0) return 0;
+	if (!data || data_sz < 4 || !dst) return 0;
 
 	// Get and check header word
 	uint32_t header = lp_read_u32_lep(&data);
-	if ((uint8_t)header != LP_CODEC_LZ77) return 0;
+	if ((uint8_t)header != LP_CODEC_LZ77 || (header >> 8) > dst_cap) return 0;
+	LP_TRACE_BEGIN(trace);
 
 	uint32_t flags;
 	int32_t ii, jj, dstS = header >> 8;
-	uint8_t *srcL = data, *dstD = (uint8_t*)lp_alloc(0, dstS);
+	uint8_t *srcL = data, *dstD = dst;
 
 	for (ii = 0, jj = -1; ii < dstS; jj--)
 	{
@@ -584,15 +624,15 @@ void* lp_dec_lz77(void* data, size_t* data_sz)
 			dstD[ii++] = *srcL++;
 	}
 
-	*data_sz = (size_t)dstS;
-	return dstD;
+	LP_TRACE_END(trace, "lp_dec_lz77");
+	return (size_t)dstS;
 }
+void* lp_dec_lz77(void* data, size_t* data_sz) { return lp_cod_alloc(data, data_sz, data_sz ? lp_dec_size(data, *data_sz) : 0, lp_dec_lz77_to); }
 
-void* lp_cod_lz77(void* data, size_t* data_sz)
+size_t lp_cod_lz77_to(void* data, size_t data_sz, void* dst, size_t dst_cap)
 {
-	if (!data || !data_sz || *data_sz <= 0) return 0;
-	size_t dst_sz = *data_sz + *data_sz/8 + 16;
-	void* dst = lp_alloc(0, dst_sz);
+	if (!data || data_sz == 0 || !dst || dst_cap < lp_cod_bound(data_sz)) return 0;
+	LP_TRACE_BEGIN(trace);
 
 	int32_t i, c, len, r, s, last_match_length, code_buf_ptr;
 	uint8_t code_buf[17];
@@ -602,7 +642,7 @@ void* lp_cod_lz77(void* data, size_t* data_sz)
 	uint32_t savematch;
 
 	struct LPCodecLZ77 ctx = { 0 };
-	ctx.InSize = (uint32_t)*data_sz;
+	ctx.InSize = (uint32_t)data_sz;
 	ctx.InBuf = data;
 	ctx.OutBuf = dst;
 
@@ -724,7 +764,9 @@ void* lp_cod_lz77(void* data, size_t* data_sz)
 	filesize[2] = ((ctx.InSize >> 8) & 0xFF);
 	filesize[3] = ((ctx.InSize >> 16) & 0xFF);
 
-	*data_sz = (size_t)(uintptr_t)LP_ALIGN(ctx.OutSize, 4);
-	dst = lp_alloc(dst, *data_sz);
-	return dst;
-} 
+	size_t dst_sz = (size_t)(uintptr_t)LP_ALIGN(ctx.OutSize, 4);
+	memset(ctx.OutBuf + ctx.OutSize, 0, dst_sz - ctx.OutSize); // deterministic alignment padding
+	LP_TRACE_END(trace, "lp_cod_lz77");
+	return dst_sz;
+}
+void* lp_cod_lz77(void* data, size_t* data_sz) { return lp_cod_alloc(data, data_sz, data_sz ? lp_cod_bound(*data_sz) : 0, lp_cod_lz77_to); }
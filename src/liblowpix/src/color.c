@@ -0,0 +1,107 @@
+#include <math.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * COLOR SPACES
+ *
+ * Conversions are done in float once per RGB555 color into 32K entry
+ * tables, distance queries on RGB555 colors are then only lookups and
+ * a few multiplies.
+ *************************************************************************/
+
+static float lp_srgb_linear(uint32_t c)
+{
+	float v = c / 255.0f;
+	return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+void lp_col_oklab(uint32_t col, float lab[3])
+{
+	float r = lp_srgb_linear(col & 0xFF), g = lp_srgb_linear(col>>8 & 0xFF), b = lp_srgb_linear(col>>16 & 0xFF);
+	float l = cbrtf(0.4122214708f*r + 0.5363325363f*g + 0.0514459929f*b);
+	float m = cbrtf(0.2119034982f*r + 0.6806995451f*g + 0.1073969566f*b);
+	float s = cbrtf(0.0883024619f*r + 0.2817188376f*g + 0.6299787005f*b);
+	lab[0] = 0.2104542553f*l + 0.7936177850f*m - 0.0040720468f*s;
+	lab[1] = 1.9779984951f*l - 2.4285922050f*m + 0.4505937099f*s;
+	lab[2] = 0.0259040371f*l + 0.7827717662f*m - 0.8086757660f*s;
+}
+
+static float lp_cielab_f(float t) { return t > 216.0f/24389.0f ? cbrtf(t) : (24389.0f/27.0f*t + 16.0f) / 116.0f; }
+void lp_col_cielab(uint32_t col, float lab[3]) // D65 white
+{
+	float r = lp_srgb_linear(col & 0xFF), g = lp_srgb_linear(col>>8 & 0xFF), b = lp_srgb_linear(col>>16 & 0xFF);
+	float x = lp_cielab_f((0.4124564f*r + 0.3575761f*g + 0.1804375f*b) / 0.95047f);
+	float y = lp_cielab_f( 0.2126729f*r + 0.7151522f*g + 0.0721750f*b);
+	float z = lp_cielab_f((0.0193339f*r + 0.1191920f*g + 0.9503041f*b) / 1.08883f);
+	lab[0] = 116.0f*y - 16.0f;
+	lab[1] = 500.0f*(x - y);
+	lab[2] = 200.0f*(y - z);
+}
+
+static void lp_col_space(uint32_t col, enum LPColorMetric metric, float v[3])
+{
+	switch (metric)
+	{
+	case LP_METRIC_OKLAB: lp_col_oklab(col, v); break;
+	case LP_METRIC_CIE76: case LP_METRIC_CIE94: lp_col_cielab(col, v); break;
+	default: v[0] = (float)(col & 0xFF), v[1] = (float)(col>>8 & 0xFF), v[2] = (float)(col>>16 & 0xFF); break;
+	}
+}
+// squared distance between two points of the metric space, order matters for CIE94 (v1 is the reference)
+float lp_col_dist2_space(const float* v1, const float* v2, enum LPColorMetric metric)
+{
+	float dl = v1[0] - v2[0], da = v1[1] - v2[1], db = v1[2] - v2[2];
+	if (metric != LP_METRIC_CIE94) return dl*dl + da*da + db*db;
+	// graphic arts weights
+	float c1 = sqrtf(v1[1]*v1[1] + v1[2]*v1[2]), c2 = sqrtf(v2[1]*v2[1] + v2[2]*v2[2]), dc = c1 - c2;
+	float dh2 = da*da + db*db - dc*dc, sc = 1.0f + 0.045f*c1, sh = 1.0f + 0.015f*c1;
+	return dl*dl + dc*dc / (sc*sc) + (dh2 > 0 ? dh2 : 0) / (sh*sh);
+}
+float lp_col_dist(uint32_t col1, uint32_t col2, enum LPColorMetric metric)
+{
+	float v1[3], v2[3];
+	lp_col_space(col1, metric, v1);
+	lp_col_space(col2, metric, v2);
+	return sqrtf(lp_col_dist2_space(v1, v2, metric));
+}
+
+// tables are built on first use by one thread while the others wait for it, the last chunk done
+// marks it ready so a waiter running inside the builder's lp_parallel_for (nested pool tasks) can't deadlock
+enum { LP_COLTAB_OKLAB, LP_COLTAB_CIELAB, LP_COLTAB_COUNT };
+static float lp_coltab[LP_COLTAB_COUNT][32768][3];
+static uint32_t lp_coltab_state[LP_COLTAB_COUNT]; // 0 empty, 1 building, 2 ready
+static uint32_t lp_coltab_done[LP_COLTAB_COUNT];
+static void lp_coltab_build_chunk(void* user, uint32_t chunk)
+{
+	uint32_t t = *(uint32_t*)user;
+	uint16_t v555[1024];
+	uint32_t col[1024];
+	for (uint32_t i = 0; i < 1024; ++i) v555[i] = (uint16_t)(chunk * 1024 + i);
+	lp_col8_n(col, v555, 1024);
+	for (uint32_t i = 0; i < 1024; ++i)
+		lp_col_space(col[i], t == LP_COLTAB_OKLAB ? LP_METRIC_OKLAB : LP_METRIC_CIE76, lp_coltab[t][chunk * 1024 + i]);
+	if (lp_atomic_add(&lp_coltab_done[t], 1) == 32768 / 1024 - 1) lp_atomic_store(&lp_coltab_state[t], 2);
+}
+const float* lp_col_table(enum LPColorMetric metric)
+{
+	uint32_t t = metric == LP_METRIC_OKLAB ? LP_COLTAB_OKLAB : metric == LP_METRIC_CIE76 || metric == LP_METRIC_CIE94 ? LP_COLTAB_CIELAB : LP_COLTAB_COUNT;
+	if (t == LP_COLTAB_COUNT) return 0;
+	if (lp_atomic_load(&lp_coltab_state[t]) != 2)
+	{
+		if (lp_atomic_cas(&lp_coltab_state[t], 0, 1)) lp_parallel_for(32768 / 1024, lp_coltab_build_chunk, &t);
+		else while (lp_atomic_load(&lp_coltab_state[t]) != 2) if (!lp_thread_help()) lp_thread_yield();
+	}
+	return lp_coltab[t][0];
+}
+
+float lp_col5_dist2(uint16_t col1, uint16_t col2, enum LPColorMetric metric)
+{
+	const float* tab = lp_col_table(metric);
+	if (!tab)
+	{
+		uint32_t c1 = lp_col8(col1), c2 = lp_col8(col2);
+		int dr = (int)(c1 & 0xFF) - (int)(c2 & 0xFF), dg = (int)(c1>>8 & 0xFF) - (int)(c2>>8 & 0xFF), db = (int)(c1>>16 & 0xFF) - (int)(c2>>16 & 0xFF);
+		return (float)(dr*dr + dg*dg + db*db);
+	}
+	return lp_col_dist2_space(tab + (col1 & 0x7FFF)*3, tab + (col2 & 0x7FFF)*3, metric);
+}
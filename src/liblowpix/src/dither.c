@@ -0,0 +1,288 @@
+#include <string.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * REMAP / DITHER
+ *
+ * Everything goes through RGB555 like the hardware does: pixels are
+ * converted with lp_col5 and looked up in a 32K table giving the nearest
+ * palette entry, itself restricted to RGB555. Perceptual metrics only
+ * change how that table is built.
+ * Error diffusion runs as a wavefront: rows are claimed in order by the
+ * workers and row y only processes pixel x once row y-1 is past x+1.
+ *************************************************************************/
+
+#define LP_DITHER_RING      (4)     // error rows in flight, must be >= 3
+#define LP_DITHER_CHUNK     (16)    // rows per task for the per pixel kernels
+#define LP_REMAP_CACHE      (8)     // remap tables kept for the next calls with the same palette
+
+struct LPRemap
+{
+	uint32_t refs, cached;  // under lp_remap_lock
+	uint32_t cc;
+	uint32_t col[256];      // palette restricted to RGB555, back in 8 bits per channel
+	uint16_t col5[256];
+	enum LPColorMetric metric;
+	const float* tab;       // lp_col_table of the metric, 0 for plain RGB
+	uint8_t lut[32768];     // RGB555 -> nearest palette entry
+};
+
+static void lp_remap_lut_chunk(void* user, uint32_t chunk)
+{
+	struct LPRemap* rm = user;
+	uint16_t v555[1024];
+	uint32_t col[1024];
+	for (uint32_t i = 0; i < 1024; ++i) v555[i] = (uint16_t)(chunk * 1024 + i);
+	lp_col8_n(col, v555, 1024);
+	if (rm->tab)
+	{
+		for (uint32_t v = chunk * 1024; v < (chunk + 1) * 1024; ++v)
+		{
+			uint32_t best = 0;
+			float best_d = 1e30f;
+			for (uint32_t i = 0; i < rm->cc && best_d > 0; ++i)
+			{
+				float d = lp_col_dist2_space(rm->tab + v*3, rm->tab + rm->col5[i]*3, rm->metric);
+				if (d < best_d) best_d = d, best = i;
+			}
+			rm->lut[v] = (uint8_t)best;
+		}
+		return;
+	}
+	for (uint32_t v = chunk * 1024; v < (chunk + 1) * 1024; ++v)
+	{
+		uint32_t c = col[v - chunk * 1024], best = 0, best_d = ~0u;
+		int r = c & 0xFF, g = c>>8 & 0xFF, b = c>>16 & 0xFF;
+		for (uint32_t i = 0; i < rm->cc && best_d; ++i)
+		{
+			int dr = r - (int)(rm->col[i] & 0xFF), dg = g - (int)(rm->col[i]>>8 & 0xFF), db = b - (int)(rm->col[i]>>16 & 0xFF);
+			uint32_t d = (uint32_t)(dr*dr + dg*dg + db*db);
+			if (d < best_d) best_d = d, best = i;
+		}
+		rm->lut[v] = (uint8_t)best;
+	}
+}
+// most recently used first, so long running processes (editor, lowpixc daemon) only build tables for new palettes
+static struct LPRemap* lp_remap_cache[LP_REMAP_CACHE];
+static uint32_t lp_remap_lock;
+static void lp_remap_release(struct LPRemap* rm)
+{
+	while (!lp_atomic_cas(&lp_remap_lock, 0, 1)) lp_thread_yield();
+	int unused = --rm->refs == 0 && !rm->cached;
+	lp_atomic_store(&lp_remap_lock, 0);
+	if (unused) lp_heap_alloc(rm, 0);
+}
+static struct LPRemap* lp_remap_get(struct LPPalette* pal, enum LPColorMetric metric)
+{
+	uint16_t col5[256];
+	uint32_t cc = LP_MIN(pal->col_count, 256), i;
+	lp_col5_n(col5, pal->col, cc);
+	while (!lp_atomic_cas(&lp_remap_lock, 0, 1)) lp_thread_yield();
+	struct LPRemap* rm = 0;
+	for (i = 0; i < LP_REMAP_CACHE && lp_remap_cache[i]; ++i)
+	{
+		struct LPRemap* c = lp_remap_cache[i];
+		if (c->cc == cc && c->metric == metric && memcmp(c->col5, col5, cc * sizeof(*col5)) == 0)
+		{
+			memmove(lp_remap_cache + 1, lp_remap_cache, i * sizeof(*lp_remap_cache));
+			lp_remap_cache[0] = rm = c, ++rm->refs;
+			break;
+		}
+	}
+	lp_atomic_store(&lp_remap_lock, 0);
+	if (rm) return rm;
+
+	rm = lp_heap_alloc(0, sizeof(*rm)); // cached beyond the caller's arena
+	rm->refs = 1, rm->cached = 1;
+	rm->cc = cc;
+	rm->metric = metric;
+	rm->tab = lp_col_table(metric);
+	memcpy(rm->col5, col5, cc * sizeof(*col5));
+	lp_col8_n(rm->col, rm->col5, rm->cc);
+	lp_parallel_for(32768 / 1024, lp_remap_lut_chunk, rm);
+
+	while (!lp_atomic_cas(&lp_remap_lock, 0, 1)) lp_thread_yield();
+	// another thread may have built the same table meanwhile, keep only one of them cached
+	for (i = 0; i < LP_REMAP_CACHE && lp_remap_cache[i]; ++i)
+	{
+		struct LPRemap* c = lp_remap_cache[i];
+		if (c->cc == cc && c->metric == metric && memcmp(c->col5, col5, cc * sizeof(*col5)) == 0)
+		{
+			++c->refs;
+			lp_atomic_store(&lp_remap_lock, 0);
+			lp_heap_alloc(rm, 0);
+			return c;
+		}
+	}
+	struct LPRemap* old = lp_remap_cache[LP_REMAP_CACHE - 1];
+	int unused = old && --old->cached == 0 && old->refs == 0;
+	memmove(lp_remap_cache + 1, lp_remap_cache, (LP_REMAP_CACHE - 1) * sizeof(*lp_remap_cache));
+	lp_remap_cache[0] = rm;
+	lp_atomic_store(&lp_remap_lock, 0);
+	if (unused) lp_heap_alloc(old, 0);
+	return rm;
+}
+void lp_remap_flush(void)
+{
+	struct LPRemap* unused[LP_REMAP_CACHE];
+	uint32_t n = 0;
+	while (!lp_atomic_cas(&lp_remap_lock, 0, 1)) lp_thread_yield();
+	for (uint32_t i = 0; i < LP_REMAP_CACHE && lp_remap_cache[i]; ++i)
+	{
+		struct LPRemap* c = lp_remap_cache[i];
+		if (--c->cached == 0 && c->refs == 0) unused[n++] = c; // tables in use go with their last release
+		lp_remap_cache[i] = 0;
+	}
+	lp_atomic_store(&lp_remap_lock, 0);
+	while (n) lp_heap_alloc(unused[--n], 0);
+}
+
+struct LPDitherCtx
+{
+	const struct LPImage* img;
+	const struct LPRemap* rm;
+	uint8_t* out;
+	enum LPDither mode;
+	// ordered
+	uint32_t n;             // matrix size
+	uint8_t bias_pos[8][8][16], bias_neg[8][8][16]; // [y][x] for pixels x..x+3, per channel, alpha untouched
+	// error diffusion
+	uint32_t next_row;
+	uint32_t* prog;         // pixels done per row
+	int32_t* err;           // LP_DITHER_RING slots of 2 rows (from y-1, from y-2) of (w+4)*3, in 1/16
+};
+
+// ordered: threshold added per channel then plain lookup
+static uint32_t lp_bayer(uint32_t x, uint32_t y, uint32_t bits)
+{
+	uint32_t v = 0;
+	for (uint32_t i = 0; i < bits; ++i) v = v << 2 | ((x ^ y) >> i & 1) << 1 | (y >> i & 1);
+	return v;
+}
+static void lp_dither_ordered_rows(void* user, uint32_t chunk)
+{
+	struct LPDitherCtx* ctx = user;
+	const struct LPImage* img = ctx->img;
+	const uint8_t* lut = ctx->rm->lut;
+	uint32_t w = img->w, n = ctx->n, y1 = LP_MIN((chunk + 1) * LP_DITHER_CHUNK, img->h);
+	for (uint32_t y = chunk * LP_DITHER_CHUNK; y < y1; ++y)
+	{
+		const uint32_t* s = img->pix + (size_t)y*w;
+		uint8_t* o = ctx->out + (size_t)y*w;
+		const uint8_t (*bp)[16] = ctx->bias_pos[y & (n-1)], (*bn)[16] = ctx->bias_neg[y & (n-1)];
+		uint32_t x = 0;
+#ifdef LP_SSE2
+		for (; x + 4 <= w; x += 4)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)(s + x));
+			p = _mm_adds_epu8(p, _mm_loadu_si128((const __m128i*)bp[x & (n-1)]));
+			p = _mm_subs_epu8(p, _mm_loadu_si128((const __m128i*)bn[x & (n-1)]));
+			uint32_t v[4]; _mm_storeu_si128((__m128i*)v, lp_col5_sse2(p));
+			o[x] = lut[v[0]], o[x+1] = lut[v[1]], o[x+2] = lut[v[2]], o[x+3] = lut[v[3]];
+		}
+#endif
+		for (; x < w; ++x)
+		{
+			const uint8_t *p = bp[x & (n-1)], *m = bn[x & (n-1)];
+			uint32_t col = 0;
+			for (int c = 0; c < 3; ++c)
+			{
+				int v = (int)(s[x] >> (c*8) & 0xFF) + p[0] - m[0];
+				col |= (uint32_t)(v < 0 ? 0 : v > 255 ? 255 : v) << (c*8);
+			}
+			o[x] = lut[lp_col5(col)];
+		}
+	}
+}
+
+// error diffusion, weights in 1/16: floyd-steinberg 7 right, 3/5/1 below; atkinson 1/8 to 6 neighbors
+static int32_t* lp_dither_err(struct LPDitherCtx* ctx, uint32_t y, int from2)
+{ return ctx->err + ((y % LP_DITHER_RING)*2 + from2) * (ctx->img->w + 4) * 3 + 2*3; }
+static int32_t lp_dither_round16(int32_t a) { return a >= 0 ? (a + 8) >> 4 : -((-a + 8) >> 4); }
+static void lp_dither_diffuse_row(struct LPDitherCtx* ctx, uint32_t y)
+{
+	const struct LPImage* img = ctx->img;
+	const struct LPRemap* rm = ctx->rm;
+	uint32_t w = img->w, known = 0;
+	const int atk = ctx->mode == LP_DITHER_ATKINSON;
+	const int32_t wr1 = atk ? 2 : 7, wr2 = atk ? 2 : 0, wdl = atk ? 2 : 3, wd = atk ? 2 : 5, wdr = atk ? 2 : 1, wdd = atk ? 2 : 0;
+	const uint32_t* s = img->pix + (size_t)y*w;
+	uint8_t* o = ctx->out + (size_t)y*w;
+	int32_t *d1 = lp_dither_err(ctx, y, 0), *d2 = lp_dither_err(ctx, y, 1);
+	int32_t *n1 = lp_dither_err(ctx, y + 1, 0), *n2 = lp_dither_err(ctx, y + 2, 1);
+	int32_t c1[3] = { 0 }, c2[3] = { 0 };
+	for (int c = 0; c < 3; ++c) n1[-3+c] = n1[w*3+c] = n1[w*3+3+c] = 0; // padding only this row writes
+	for (uint32_t x = 0; x < w; ++x)
+	{
+		uint32_t need = LP_MIN(x + 2, w);
+		for (int spin = 0; y > 0 && known < need; ++spin)
+		{
+			known = lp_atomic_load(&ctx->prog[y-1]);
+			if (known < need) { if (spin < 64) lp_cpu_relax(); else lp_thread_yield(); }
+		}
+		int32_t v[3];
+		uint32_t col = 0;
+		for (int c = 0; c < 3; ++c)
+		{
+			v[c] = (int32_t)(s[x] >> (c*8) & 0xFF) + lp_dither_round16(c1[c] + d1[x*3+c] + d2[x*3+c]);
+			v[c] = v[c] < 0 ? 0 : v[c] > 255 ? 255 : v[c];
+			d1[x*3+c] = d2[x*3+c] = 0;
+			col |= (uint32_t)v[c] << (c*8);
+		}
+		uint8_t ix = rm->lut[lp_col5(col)];
+		o[x] = ix;
+		int32_t *p1 = n1 + x*3, *p2 = n2 + x*3;
+		for (int c = 0; c < 3; ++c)
+		{
+			int32_t e = v[c] - (int32_t)(rm->col[ix] >> (c*8) & 0xFF);
+			c1[c] = c2[c] + e*wr1, c2[c] = e*wr2;
+			p1[c-3] += e*wdl, p1[c] += e*wd, p1[c+3] += e*wdr;
+			p2[c] += e*wdd;
+		}
+		if ((x & 3) == 3) lp_atomic_store(&ctx->prog[y], x + 1);
+	}
+	lp_atomic_store(&ctx->prog[y], w);
+}
+static void lp_dither_diffuse_worker(void* user, uint32_t ix)
+{
+	struct LPDitherCtx* ctx = user;
+	(void)ix;
+	for (uint32_t y; (y = lp_atomic_add(&ctx->next_row, 1)) < ctx->img->h;)
+		lp_dither_diffuse_row(ctx, y);
+}
+
+uint8_t* lp_img_remap(struct LPImage* img, struct LPPalette* pal, enum LPDither dither, enum LPColorMetric metric)
+{
+	if (!img || !pal || pal->col_count == 0) return 0;
+	struct LPDitherCtx ctx = { 0 };
+	ctx.img = img, ctx.mode = dither;
+	struct LPRemap* rm = lp_remap_get(pal, metric);
+	ctx.rm = rm;
+	ctx.out = lp_alloc(0, (size_t)img->w * img->h);
+	if (dither == LP_DITHER_FLOYD || dither == LP_DITHER_ATKINSON)
+	{
+		ctx.prog = lp_zalloc(img->h * sizeof(*ctx.prog));
+		ctx.err = lp_zalloc(LP_DITHER_RING * 2 * (img->w + 4) * 3 * sizeof(*ctx.err));
+		lp_parallel_for(LP_MIN(lp_thread_count(), img->h), lp_dither_diffuse_worker, &ctx);
+		lp_alloc(ctx.err, 0); lp_alloc(ctx.prog, 0);
+	}
+	else
+	{
+		// thresholds centered on 0 and spread over the typical distance between palette colors
+		uint32_t bits = dither == LP_DITHER_BAYER8 ? 3 : dither == LP_DITHER_BAYER4 ? 2 : 0, side = 1;
+		while (side*side*side < ctx.rm->cc) ++side;
+		int spread = 256 / (int)side;
+		ctx.n = 1u << bits;
+		for (uint32_t y = 0; y < ctx.n; ++y)
+			for (uint32_t x = 0; x < ctx.n; ++x)
+				for (uint32_t k = 0; k < 4; ++k) // 4 consecutive pixels starting at x
+				{
+					int b = bits ? (int)(lp_bayer((x + k) & (ctx.n-1), y, bits)*2 + 1) * spread / (int)(2 * ctx.n*ctx.n) - spread/2 : 0;
+					for (uint32_t c = 0; c < 3; ++c)
+						ctx.bias_pos[y][x][k*4+c] = (uint8_t)(b > 0 ? b : 0), ctx.bias_neg[y][x][k*4+c] = (uint8_t)(b < 0 ? -b : 0);
+				}
+		lp_parallel_for((img->h + LP_DITHER_CHUNK - 1) / LP_DITHER_CHUNK, lp_dither_ordered_rows, &ctx);
+	}
+	lp_remap_release(rm);
+	return ctx.out;
+}
@@ -0,0 +1,101 @@
+#include <stddef.h>
+#include <string.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * FADE / CYCLE TABLES
+ *
+ * Tables are step_count palettes stored one after the other, so a
+ * single lp_pal_save writes them all and the console only has to DMA
+ * pal->col + step*col_count.
+ * Fades are computed on the RGB555 channels in fixed point:
+ *   c = c1 + ((mulhi(d << 10, w) + 256) >> 9), w = step/(step_count-1) in Q15
+ * which is what the SSE2 path computes for 8 colors at once, so both
+ * paths give the same tables.
+ *************************************************************************/
+
+static int32_t lp_fade_channel(int32_t c1, int32_t d, int32_t w)
+{
+	int32_t t = (d * 1024 * w) >> 16;
+	return c1 + ((t + 256) >> 9);
+}
+
+struct LPPalette* lp_pal_fade(struct LPPalette* pal1, struct LPPalette* pal2, uint32_t col, uint32_t step_count)
+{
+	if (!pal1 || step_count == 0) return 0;
+	uint32_t cc = pal2 && pal2->col_count > pal1->col_count ? pal2->col_count : pal1->col_count;
+	uint32_t cc8 = (cc + 7) & ~7u;
+	if (cc == 0) return 0;
+	LP_TRACE_BEGIN(trace);
+	struct LPPalette* pal = lp_alloc(0, offsetof(struct LPPalette, col[cc * step_count]));
+	pal->col_count = cc * step_count;
+
+	// channels split in planes of int16, padded to 8 colors: 0..2 start, 3..5 delta
+	uint32_t *c1 = lp_alloc(0, cc8 * sizeof(*c1)), *c2 = lp_alloc(0, cc8 * sizeof(*c2));
+	uint16_t *s1 = lp_alloc(0, cc8 * sizeof(*s1)), *s2 = lp_alloc(0, cc8 * sizeof(*s2)), *row = lp_alloc(0, cc8 * sizeof(*row));
+	int16_t* ch = lp_alloc(0, cc8 * 6 * sizeof(*ch));
+	for (uint32_t i = 0; i < cc8; ++i)
+	{
+		c1[i] = i < pal1->col_count ? pal1->col[i] : i < cc ? pal2->col[i] : 0;
+		c2[i] = !pal2 ? col : i < pal2->col_count ? pal2->col[i] : c1[i];
+	}
+	lp_col5_n(s1, c1, cc8);
+	lp_col5_n(s2, c2, cc8);
+	for (uint32_t i = 0; i < cc8; ++i)
+		for (int c = 0; c < 3; ++c)
+		{
+			int16_t a = s1[i] >> (c*5) & 31, b = s2[i] >> (c*5) & 31;
+			ch[c*cc8 + i] = a, ch[(3+c)*cc8 + i] = (int16_t)((b - a) * 1024);
+		}
+
+	for (uint32_t k = 0; k < step_count; ++k)
+	{
+		int32_t w = step_count > 1 ? (int32_t)(((uint64_t)k * 32768 + (step_count - 1) / 2) / (step_count - 1)) : 0;
+		if (w > 32767) w = 32767; // exact for deltas up to 31
+		uint32_t i = 0;
+#ifdef LP_SSE2
+		const __m128i vw = _mm_set1_epi16((short)w), r256 = _mm_set1_epi16(256);
+		for (; i < cc8; i += 8)
+		{
+			__m128i v = _mm_setzero_si128();
+			for (int c = 0; c < 3; ++c)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i*)(ch + c*cc8 + i)), d = _mm_loadu_si128((const __m128i*)(ch + (3+c)*cc8 + i));
+				a = _mm_add_epi16(a, _mm_srai_epi16(_mm_add_epi16(_mm_mulhi_epi16(d, vw), r256), 9));
+				v = _mm_or_si128(v, _mm_sll_epi16(a, _mm_cvtsi32_si128(c*5)));
+			}
+			_mm_storeu_si128((__m128i*)(row + i), v);
+		}
+#endif
+		for (; i < cc8; ++i)
+		{
+			uint32_t v = 0;
+			for (int c = 0; c < 3; ++c) v |= (uint32_t)lp_fade_channel(ch[c*cc8 + i], ch[(3+c)*cc8 + i] / 1024, w) << (c*5);
+			row[i] = (uint16_t)v;
+		}
+		lp_col8_n(pal->col + k*cc, row, cc);
+	}
+
+	lp_alloc(ch, 0); lp_alloc(row, 0); lp_alloc(s2, 0); lp_alloc(s1, 0); lp_alloc(c2, 0); lp_alloc(c1, 0);
+	LP_TRACE_END(trace, "lp_pal_fade");
+	return pal;
+}
+
+struct LPPalette* lp_pal_cycle(struct LPPalette* pal, uint32_t first, uint32_t count, uint32_t step_count)
+{
+	if (!pal || step_count == 0 || first >= pal->col_count) return 0;
+	LP_TRACE_BEGIN(trace);
+	uint32_t cc = pal->col_count;
+	if (count > cc - first) count = cc - first;
+	struct LPPalette* npal = lp_alloc(0, offsetof(struct LPPalette, col[cc * step_count]));
+	npal->col_count = cc * step_count;
+	for (uint32_t k = 0; k < step_count; ++k)
+	{
+		uint32_t* dst = npal->col + k*cc, r = count ? k % count : 0;
+		memcpy(dst, pal->col, cc * sizeof(*dst));
+		memcpy(dst + first, pal->col + first + r, (count - r) * sizeof(*dst));
+		memcpy(dst + first + count - r, pal->col + first, r * sizeof(*dst));
+	}
+	LP_TRACE_END(trace, "lp_pal_cycle");
+	return npal;
+}
@@ -0,0 +1,116 @@
+#include <stddef.h>
+#include <string.h>
+#include "lowpix.h"
+
+#define LP_IMG_PIX_MAX (1u << 28) // 1 GB of pixels, w*h also fits the uint32 indices used on images
+
+struct LPImage* lp_img_new(uint32_t w, uint32_t h)
+{
+	if (w == 0 || h == 0 || (uint64_t)w*h > LP_IMG_PIX_MAX) return 0;
+	size_t size = offsetof(struct LPImage, pix) + (size_t)w*h*sizeof(uint32_t);
+	struct LPImage* img = lp_alloc(0, size);
+	if (!img) return 0;
+	memset(img, 0, size);
+	img->w = w, img->h = h;
+	return img;
+}
+
+struct LPImage* lp_img_clone(struct LPImage* img)
+{
+	struct LPImage* nimg = lp_alloc(0, offsetof(struct LPImage, pix[img->w*img->h]));
+	memcpy(nimg, img, offsetof(struct LPImage, pix[img->w*img->h]));
+	return nimg;
+}
+
+static struct LPImage* lp_img_load_bmp(uint8_t* data, size_t sz) // image .bmp, uncompressed
+{
+	uint32_t ofs = lp_read_u32_le(data + 10), hsz = lp_read_u32_le(data + 14), comp = lp_read_u32_le(data + 30);
+	int32_t w = (int32_t)lp_read_u32_le(data + 18), h = (int32_t)lp_read_u32_le(data + 22);
+	int bpp = lp_read_u16_le(data + 28), topdown = h < 0;
+	if (w <= 0 || h == 0 || h == INT32_MIN || (comp != 0 && comp != 3)) return 0;
+	if (topdown) h = -h;
+	if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24 && bpp != 32) return 0;
+	// header fields are checked in 64 bits against the data, none of them can wrap around it
+	uint64_t stride = ((uint64_t)w*bpp + 31) / 32 * 4;
+	if (ofs > sz || stride*(uint64_t)h > sz - ofs) return 0;
+	uint32_t pal[256] = { 0 }, cc = lp_read_u32_le(data + 46);
+	if (bpp <= 8)
+	{
+		if (cc == 0 || cc > (1u << bpp)) cc = 1u << bpp;
+		if (14 + (uint64_t)hsz + (uint64_t)cc*4 > sz) return 0;
+		uint8_t* p = data + 14 + hsz;
+		for (uint32_t i = 0; i < cc; ++i, p += 4) pal[i] = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | (uint32_t)p[2];
+	}
+	struct LPImage* img = lp_img_new(w, h); if (!img) return 0;
+	for (int32_t y = 0; y < h; ++y)
+	{
+		uint8_t* s = data + ofs + (size_t)stride*(size_t)(topdown ? y : h - 1 - y);
+		uint32_t* d = img->pix + (size_t)y*(size_t)w;
+		for (int32_t x = 0; x < w; ++x)
+		{
+			switch (bpp)
+			{
+			case 1: d[x] = pal[s[x>>3] >> (7 - (x&7)) & 1]; break;
+			case 4: d[x] = pal[s[x>>1] >> (x&1 ? 0 : 4) & 15]; break;
+			case 8: d[x] = pal[s[x]]; break;
+			case 24: d[x] = (uint32_t)s[x*3] << 16 | (uint32_t)s[x*3+1] << 8 | (uint32_t)s[x*3+2]; break;
+			case 32: d[x] = (uint32_t)s[x*4] << 16 | (uint32_t)s[x*4+1] << 8 | (uint32_t)s[x*4+2]; break;
+			}
+		}
+	}
+	return img;
+}
+static struct LPImage* lp_img_load_tga(uint8_t* data, size_t sz) // image .tga, color mapped or true color, raw or rle
+{
+	int type = data[2], rle = type >= 9, bpp = data[16];
+	if (type != 1 && type != 2 && type != 9 && type != 10) return 0;
+	uint32_t w = lp_read_u16_le(data+12), h = lp_read_u16_le(data+14), topdown = data[17] & 0x20;
+	uint32_t pal[256] = { 0 }, cc = data[1] ? lp_read_u16_le(data+5) : 0, cbpp = data[7];
+	size_t i = 18 + data[0];
+	if (type == 1 || type == 9)
+	{
+		if (bpp != 8 || cc > 256 || (cbpp != 24 && cbpp != 32)) return 0;
+		if (i + cc*(cbpp/8) > sz) return 0;
+		for (uint32_t c = 0; c < cc; ++c, i += cbpp/8) pal[c] = (uint32_t)data[i] << 16 | (uint32_t)data[i+1] << 8 | (uint32_t)data[i+2];
+	}
+	else if (bpp != 24 && bpp != 32) return 0;
+	else i += cc*(cbpp/8);
+	// the pixels must fit what's left: raw ones byte for byte, rle packets expand at most 128 times
+	if (i >= sz || (uint64_t)w*h > (uint64_t)(sz - i) / (bpp/8) * (rle ? 128 : 1)) return 0;
+	struct LPImage* img = lp_img_new(w, h); if (!img) return 0;
+	uint32_t n = w*h, p = 0, inc = bpp/8, run = 0, raw = 0;
+	while (p < n)
+	{
+		if (rle && run == 0 && raw == 0)
+		{
+			if (i >= sz) break;
+			if (data[i] & 0x80) run = (data[i++] & 0x7F) + 1; else raw = data[i++] + 1;
+		}
+		if (i + inc > sz) break;
+		uint32_t col = inc == 1 ? pal[data[i]] : (uint32_t)data[i] << 16 | (uint32_t)data[i+1] << 8 | (uint32_t)data[i+2];
+		uint32_t y = p / w, x = p % w;
+		img->pix[(topdown ? y : h - 1 - y)*w + x] = col;
+		++p;
+		if (!rle || raw) { i += inc; if (raw) --raw; }
+		else if (--run == 0) i += inc;
+	}
+	return img;
+}
+static struct LPImage* lp_img_load_i(void* data, size_t sz)
+{
+	if (sz > 54 && strncmp("BM", data, 2) == 0) return lp_img_load_bmp(data, sz);
+	if (sz > 18 && ((uint8_t*)data)[1] <= 1) return lp_img_load_tga(data, sz);
+	return 0;
+}
+struct LPImage* lp_img_load(const char* fn, void* data, size_t sz)
+{
+	struct LPFileMap* fmap = 0;
+	if (fn && !data)
+	{
+		if (!(fmap = lp_mmap(fn))) return 0;
+		data = fmap->mem, sz = fmap->size;
+	}
+	struct LPImage* img = lp_img_load_i(data, sz);
+	if (fmap) lp_munmap(fmap);
+	return img;
+}
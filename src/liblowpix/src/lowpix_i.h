@@ -0,0 +1,85 @@
+#ifndef LP_LOWPIX_I_H
+#define LP_LOWPIX_I_H
+
+// liblowpix internals shared between translation units, not part of the public API
+
+#include "lowpix.h"
+
+// ATOMICS - 32 bit, full barrier semantics on MSVC, acquire/release elsewhere;
+// the _sc versions are sequentially consistent everywhere, for a store then a load of another variable
+#ifdef _MSC_VER
+#include <intrin.h>
+#define lp_atomic_load(p) (_ReadWriteBarrier(), *(volatile long*)(p))
+#define lp_atomic_store(p, v) do { _ReadWriteBarrier(); *(volatile long*)(p) = (long)(v); _ReadWriteBarrier(); } while (0)
+#define lp_atomic_add(p, v) ((uint32_t)_InterlockedExchangeAdd((volatile long*)(p), (long)(v))) // returns previous value
+#define lp_atomic_cas(p, e, d) (_InterlockedCompareExchange((volatile long*)(p), (long)(d), (long)(e)) == (long)(e))
+#define lp_cpu_relax() _mm_pause()
+#define lp_atomic_load_ptr(p) (_ReadWriteBarrier(), *(void* volatile*)(p))
+#define lp_atomic_store_ptr(p, v) do { _ReadWriteBarrier(); *(void* volatile*)(p) = (void*)(v); _ReadWriteBarrier(); } while (0)
+#define lp_atomic_load_sc(p) lp_atomic_load(p) // interlocked operations are full fences
+#define lp_atomic_add_sc(p, v) lp_atomic_add(p, v)
+#else
+#define lp_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define lp_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define lp_atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL) // returns previous value
+#define lp_atomic_cas(p, e, d) __atomic_compare_exchange_n((p), &(uint32_t){ (e) }, (d), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define lp_atomic_load_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define lp_atomic_store_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define lp_atomic_load_sc(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define lp_atomic_add_sc(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#if defined(__i386__) || defined(__x86_64__)
+#define lp_cpu_relax() __builtin_ia32_pause()
+#else
+#define lp_cpu_relax() ((void)0)
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define LP_TLS __declspec(thread)
+#else
+#define LP_TLS __thread
+#endif
+
+// MEM
+extern void* lp_heap_alloc(void* ptr, size_t nsize); // lp_alloc that ignores the bound arena, for memory outliving a job
+extern void* lp_raw_alloc(void* ptr, size_t nsize);  // never tracked, for the library's own tables that live until exit
+
+// THREAD
+extern void lp_thread_yield(void);
+extern int lp_thread_help(void); // runs one queued pool task if there is one, for loops waiting on other tasks
+
+// TRACE - LP_TRACE_BEGIN(t) ... LP_TRACE_END(t, "name") records a span when tracing is on,
+// both are empty without LP_TRACE_ENABLE; names must be string literals
+#ifdef LP_TRACE_ENABLE
+extern uint32_t lp_trace_on;
+extern void lp_trace_span(const char* name, uint64_t begin);
+#define LP_TRACE_BEGIN(t) uint64_t t = lp_atomic_load(&lp_trace_on) ? lp_time_ns() : 0
+#define LP_TRACE_END(t, name) do { if (t) lp_trace_span(name, t); } while (0)
+#else
+#define LP_TRACE_BEGIN(t)
+#define LP_TRACE_END(t, name) ((void)0)
+#endif
+
+// COLOR SPACES
+// squared distance between two points of lp_col_table, v1 is the reference for CIE94
+extern float lp_col_dist2_space(const float* v1, const float* v2, enum LPColorMetric metric);
+
+// SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LP_SSE2
+#include <emmintrin.h>
+// 4 colors to RGB555 in the low 16 bits of each 32 bit lane, same rounding as lp_col5: (v*31 + 128) / 255 as a multiply-shift
+static inline __m128i lp_col5_sse2(__m128i p)
+{
+	const __m128i zero = _mm_setzero_si128(), m31 = _mm_set1_epi16(31), r128 = _mm_set1_epi16(128), d255 = _mm_set1_epi16((short)0x8081);
+	const __m128i pack = _mm_setr_epi16(1, 32, 1024, 0, 1, 32, 1024, 0);
+	__m128i lo = _mm_unpacklo_epi8(p, zero), hi = _mm_unpackhi_epi8(p, zero);
+	lo = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(lo, m31), r128), d255), 7);
+	hi = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(hi, m31), r128), d255), 7);
+	lo = _mm_madd_epi16(lo, pack), hi = _mm_madd_epi16(hi, pack);
+	lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32)), hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+	return _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3,1,2,0)), _mm_shuffle_epi32(hi, _MM_SHUFFLE(3,1,2,0)));
+}
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #else
+#define _GNU_SOURCE // dladdr
+#include <dlfcn.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -10,72 +12,500 @@
 #endif
 #include <stdlib.h>
 #include <string.h>
-#include "lowpix.h"
+#include "lowpix_i.h"
 
-#ifndef LP_ALLOC_CUSTOM
-void* lp_alloc(void* ptr, size_t nsize)
+/*************************************************************************
+ * TRACKING
+ *
+ * Off by default, lp_alloc then only pays for one load and branch. Calls
+ * are counted per call site (return address of lp_alloc/lp_zalloc, of
+ * lp_heap_alloc inside the library) in a fixed hash table, sites that
+ * don't fit share slot 0. Live heap blocks are followed in a pointer hash
+ * table to know their size and site when freed; blocks allocated while
+ * tracking was off are unknown and ignored when freed. Arena memory is
+ * counted as calls only, the arena blocks themselves are live heap.
+ * One spinlock guards everything, tracking is for diagnostics.
+ *************************************************************************/
+
+#define LP_MEM_SITES    (4096)  // power of 2
+#define LP_MEM_DEAD     ((uintptr_t)1)
+
+#ifdef _MSC_VER
+#define LP_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define LP_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+struct LPMemSite { void* site; uint64_t calls, bytes, current, peak, live; };
+struct LPMemLive { uintptr_t p; size_t size; uint32_t site; };
+static uint32_t lp_mem_tracking;
+static uint32_t lp_mem_lock;
+static struct LPMemStats lp_mem;
+static struct LPMemSite lp_mem_site[LP_MEM_SITES];
+static struct LPMemLive* lp_mem_live;
+static size_t lp_mem_live_cap, lp_mem_live_used; // used counts dead slots too
+
+// the allocator under lp_alloc, also for the tracking tables themselves
+void* lp_raw_alloc(void* ptr, size_t nsize)
 {
+#ifdef LP_ALLOC_CUSTOM
+	return lp_alloc(ptr, nsize);
+#else
 	if (nsize == 0) { free(ptr); return NULL; }
 	else return realloc(ptr, nsize);
+#endif
+}
+static size_t lp_mem_hash(uintptr_t v, size_t cap) { return (size_t)(((uint64_t)v >> 4) * 0x9E3779B97F4A7C15ull >> 32) & (cap - 1); }
+static uint32_t lp_mem_site_ix(void* site)
+{
+	for (size_t i = lp_mem_hash((uintptr_t)site, LP_MEM_SITES), n = 0; n < LP_MEM_SITES / 4; i = (i + 1) & (LP_MEM_SITES - 1), ++n)
+	{
+		if (i == 0) continue;
+		if (lp_mem_site[i].site == site) return (uint32_t)i;
+		if (!lp_mem_site[i].site) { lp_mem_site[i].site = site; return (uint32_t)i; }
+	}
+	return 0;
+}
+static void lp_mem_lock_i(void) { while (!lp_atomic_cas(&lp_mem_lock, 0, 1)) lp_cpu_relax(); }
+static void lp_mem_unlock_i(void) { lp_atomic_store(&lp_mem_lock, 0); }
+
+static void lp_mem_count(void* site, size_t nsize)
+{
+	uint32_t h = 0;
+	while (h < 47 && (nsize >> h) != 0) ++h;
+	lp_mem_lock_i();
+	struct LPMemSite* s = &lp_mem_site[lp_mem_site_ix(site)];
+	++s->calls, s->bytes += nsize;
+	++lp_mem.calls, lp_mem.bytes += nsize, ++lp_mem.hist[h];
+	lp_mem_unlock_i();
+}
+static void lp_mem_live_insert(uintptr_t p, size_t size, uint32_t site)
+{
+	if ((lp_mem_live_used + 1) * 2 > lp_mem_live_cap)
+	{
+		struct LPMemLive* old = lp_mem_live;
+		size_t old_cap = lp_mem_live_cap;
+		lp_mem_live_cap = old_cap ? (lp_mem.live * 4 > old_cap ? old_cap * 2 : old_cap) : 1024;
+		lp_mem_live = lp_raw_alloc(0, lp_mem_live_cap * sizeof(*lp_mem_live));
+		memset(lp_mem_live, 0, lp_mem_live_cap * sizeof(*lp_mem_live));
+		lp_mem_live_used = 0;
+		for (size_t i = 0; i < old_cap; ++i)
+			if (old[i].p > LP_MEM_DEAD) lp_mem_live_insert(old[i].p, old[i].size, old[i].site);
+		lp_raw_alloc(old, 0);
+	}
+	size_t i = lp_mem_hash(p, lp_mem_live_cap);
+	while (lp_mem_live[i].p > LP_MEM_DEAD) i = (i + 1) & (lp_mem_live_cap - 1);
+	if (lp_mem_live[i].p == 0) ++lp_mem_live_used;
+	lp_mem_live[i].p = p, lp_mem_live[i].size = size, lp_mem_live[i].site = site;
 }
+// old is forgotten before the heap can hand its address to another thread
+static void lp_mem_forget(void* old)
+{
+	lp_mem_lock_i();
+	for (size_t i = lp_mem_live_cap ? lp_mem_hash((uintptr_t)old, lp_mem_live_cap) : 0; lp_mem_live_cap && lp_mem_live[i].p; i = (i + 1) & (lp_mem_live_cap - 1))
+	{
+		if (lp_mem_live[i].p != (uintptr_t)old) continue;
+		struct LPMemSite* s = &lp_mem_site[lp_mem_live[i].site];
+		s->current -= lp_mem_live[i].size, --s->live;
+		lp_mem.current -= lp_mem_live[i].size, --lp_mem.live, ++lp_mem.frees;
+		lp_mem_live[i].p = LP_MEM_DEAD;
+		break;
+	}
+	lp_mem_unlock_i();
+}
+static void lp_mem_remember(void* p, size_t size, void* site)
+{
+	lp_mem_lock_i();
+	uint32_t ix = lp_mem_site_ix(site);
+	struct LPMemSite* s = &lp_mem_site[ix];
+	lp_mem_live_insert((uintptr_t)p, size, ix);
+	s->current += size, ++s->live;
+	if (s->current > s->peak) s->peak = s->current;
+	lp_mem.current += size, ++lp_mem.live;
+	if (lp_mem.current > lp_mem.peak) lp_mem.peak = lp_mem.current;
+	lp_mem_unlock_i();
+}
+static void* lp_heap_alloc_i(void* ptr, size_t nsize, void* site)
+{
+	int track = lp_atomic_load(&lp_mem_tracking) != 0;
+	if (track && ptr) lp_mem_forget(ptr);
+	void* p = lp_raw_alloc(ptr, nsize);
+	if (track && p) lp_mem_remember(p, nsize, site);
+	return p;
+}
+void* lp_heap_alloc(void* ptr, size_t nsize) { return lp_heap_alloc_i(ptr, nsize, LP_RETURN_ADDRESS()); }
+
+void lp_mem_track(int enable)
+{
+	lp_mem_lock_i();
+	if (enable && !lp_mem_tracking)
+	{
+		memset(&lp_mem, 0, sizeof(lp_mem));
+		memset(lp_mem_site, 0, sizeof(lp_mem_site));
+		if (lp_mem_live) memset(lp_mem_live, 0, lp_mem_live_cap * sizeof(*lp_mem_live));
+		lp_mem_live_used = 0;
+	}
+	lp_atomic_store(&lp_mem_tracking, enable ? 1 : 0);
+	lp_mem_unlock_i();
+}
+void lp_mem_stats(struct LPMemStats* stats)
+{
+	lp_mem_lock_i();
+	*stats = lp_mem;
+	lp_mem_unlock_i();
+}
+
+static void lp_mem_w_site(struct LPWriter* w, void* site)
+{
+#ifndef WIN32
+	Dl_info info;
+	if (site && dladdr(site, &info) && info.dli_fname)
+	{
+		const char* fn = strrchr(info.dli_fname, '/');
+		lp_w_str(w, fn ? fn + 1 : info.dli_fname); lp_w_str(w, "+0x");
+		lp_w_hex(w, (uint32_t)((uintptr_t)site - (uintptr_t)info.dli_fbase), 0);
+		if (info.dli_sname) { lp_w_str(w, " "); lp_w_str(w, info.dli_sname); }
+		return;
+	}
+#endif
+	if (!site) { lp_w_str(w, "(other sites)"); return; }
+	lp_w_str(w, "0x");
+	if ((uint64_t)(uintptr_t)site >> 32) lp_w_hex(w, (uint32_t)((uint64_t)(uintptr_t)site >> 32), 0);
+	lp_w_hex(w, (uint32_t)(uintptr_t)site, (uint64_t)(uintptr_t)site >> 32 ? 8 : 0);
+}
+static int lp_mem_site_cmp(const void* a, const void* b)
+{
+	const struct LPMemSite *sa = a, *sb = b;
+	return sa->peak != sb->peak ? (sa->peak < sb->peak ? 1 : -1) : sa->bytes != sb->bytes ? (sa->bytes < sb->bytes ? 1 : -1) : 0;
+}
+void lp_mem_report(struct LPWriter* w, uint32_t max_sites)
+{
+	struct LPMemSite* sites = lp_raw_alloc(0, sizeof(lp_mem_site));
+	struct LPMemStats st;
+	uint32_t n = 0;
+	lp_mem_lock_i();
+	st = lp_mem;
+	for (uint32_t i = 0; i < LP_MEM_SITES; ++i)
+		if (lp_mem_site[i].calls || lp_mem_site[i].peak) sites[n++] = lp_mem_site[i];
+	lp_mem_unlock_i();
+	qsort(sites, n, sizeof(*sites), lp_mem_site_cmp);
+
+	lp_w_str(w, "memory: "); lp_w_dec(w, (int64_t)st.calls, 0); lp_w_str(w, " allocations of "); lp_w_dec(w, (int64_t)st.bytes, 0);
+	lp_w_str(w, " bytes, heap peak "); lp_w_dec(w, (int64_t)st.peak, 0); lp_w_str(w, " bytes, ");
+	lp_w_dec(w, (int64_t)st.live, 0); lp_w_str(w, " blocks ("); lp_w_dec(w, (int64_t)st.current, 0); lp_w_str(w, " bytes) live\n");
+	lp_w_str(w, "sizes:\n");
+	for (int h = 1; h < 48; ++h)
+	{
+		if (!st.hist[h]) continue;
+		lp_w_str(w, "  < 2^"); lp_w_dec(w, h, 2); lp_w_dec(w, (int64_t)st.hist[h], 12); lp_w_putc(w, '\n');
+	}
+	lp_w_str(w, "sites by heap peak:\n       calls        bytes         peak   live  site\n");
+	for (uint32_t i = 0; i < n && (!max_sites || i < max_sites); ++i)
+	{
+		lp_w_str(w, "  "); lp_w_dec(w, (int64_t)sites[i].calls, 10); lp_w_dec(w, (int64_t)sites[i].bytes, 13);
+		lp_w_dec(w, (int64_t)sites[i].peak, 13); lp_w_dec(w, (int64_t)sites[i].live, 7); lp_w_str(w, "  "); lp_mem_w_site(w, sites[i].site); lp_w_putc(w, '\n');
+	}
+	if (st.live)
+	{
+		lp_w_str(w, "live blocks by site:\n       count        bytes  site\n");
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			if (!sites[i].live) continue;
+			lp_w_str(w, "  "); lp_w_dec(w, (int64_t)sites[i].live, 10); lp_w_dec(w, (int64_t)sites[i].current, 13);
+			lp_w_str(w, "  "); lp_mem_w_site(w, sites[i].site); lp_w_putc(w, '\n');
+		}
+	}
+	lp_raw_alloc(sites, 0);
+}
+
+/*************************************************************************
+ * ARENAS
+ *
+ * Blocks are chained and kept on reset, so a batch that reuses an arena
+ * stops calling malloc after the first job. Offsets (marks) count from
+ * the start of the first block, a block's base is set when allocation
+ * moves into it. Every allocation has a 16 byte header with its size so
+ * lp_alloc can realloc arena memory, the last one grows in place.
+ *************************************************************************/
+
+#define LP_ARENA_BLOCK  (64 * 1024)
+#define LP_ARENA_HDR    (16)    // also the alignment
+
+struct LPArenaBlock
+{
+	struct LPArenaBlock* next;
+	size_t base, size;
+	uint8_t* mem;           // 16 byte aligned start of the data following the struct
+};
+struct LPArena
+{
+	struct LPArenaBlock* first;
+	struct LPArenaBlock* cur;
+	size_t used;            // in cur
+	size_t block_size;
+	uint8_t* last;          // most recent allocation, 0 once it moved or was freed
+};
+static LP_TLS struct LPArena* lp_arena_bound;
+static LP_TLS struct LPArena* lp_arena_scratch;
+
+static struct LPArenaBlock* lp_arena_block(size_t size)
+{
+	struct LPArenaBlock* b = lp_heap_alloc(0, sizeof(*b) + LP_ARENA_HDR + size);
+	b->next = 0, b->base = 0, b->size = size;
+	b->mem = LP_ALIGN(b + 1, LP_ARENA_HDR);
+	return b;
+}
+struct LPArena* lp_arena_new(size_t block_size)
+{
+	struct LPArena* a = lp_heap_alloc(0, sizeof(*a));
+	a->block_size = block_size ? block_size : LP_ARENA_BLOCK;
+	a->first = a->cur = lp_arena_block(a->block_size);
+	a->used = 0, a->last = 0;
+	return a;
+}
+void lp_arena_free(struct LPArena* a)
+{
+	if (!a) return;
+	for (struct LPArenaBlock* b = a->first, *next; b; b = next) next = b->next, lp_heap_alloc(b, 0);
+	lp_heap_alloc(a, 0);
+}
+void* lp_arena_alloc(struct LPArena* a, size_t size)
+{
+	size_t need = LP_ARENA_HDR + (size + LP_ARENA_HDR - 1) / LP_ARENA_HDR * LP_ARENA_HDR;
+	if (a->used + need > a->cur->size)
+	{
+		// the next kept block if it's large enough, otherwise the rest of the chain is replaced by a new one
+		struct LPArenaBlock* b = a->cur->next;
+		if (!b || b->size < need)
+		{
+			for (struct LPArenaBlock* n; b; b = n) n = b->next, lp_heap_alloc(b, 0);
+			b = a->cur->next = lp_arena_block(need > a->block_size ? need : a->block_size);
+		}
+		b->base = a->cur->base + a->cur->size;
+		a->cur = b, a->used = 0;
+	}
+	uint8_t* p = a->cur->mem + a->used + LP_ARENA_HDR;
+	*(size_t*)(p - LP_ARENA_HDR) = size;
+	a->used += need;
+	return a->last = p;
+}
+size_t lp_arena_mark(struct LPArena* a) { return a->cur->base + a->used; }
+void lp_arena_rewind(struct LPArena* a, size_t mark)
+{
+	struct LPArenaBlock* b = a->first;
+	while (b != a->cur && mark >= b->base + b->size) b = b->next;
+	a->cur = b, a->used = mark - b->base, a->last = 0;
+}
+void lp_arena_reset(struct LPArena* a) { lp_arena_rewind(a, 0); }
+size_t lp_arena_used(struct LPArena* a) { return lp_arena_mark(a); }
+struct LPArena* lp_arena_bind(struct LPArena* a)
+{
+	struct LPArena* prev = lp_arena_bound;
+	lp_arena_bound = a;
+	return prev;
+}
+struct LPArena* lp_scratch(void)
+{
+	if (!lp_arena_scratch) lp_arena_scratch = lp_arena_new(0);
+	return lp_arena_scratch;
+}
+
+// blocks up to the current one hold all live allocations
+static int lp_arena_owns(struct LPArena* a, const uint8_t* p)
+{
+	for (struct LPArenaBlock* b = a->first;; b = b->next)
+	{
+		if (p > b->mem && p < b->mem + (b == a->cur ? a->used : b->size)) return 1;
+		if (b == a->cur) return 0;
+	}
+}
+static void* lp_arena_realloc(struct LPArena* a, uint8_t* p, size_t nsize)
+{
+	if (!p) return nsize ? lp_arena_alloc(a, nsize) : 0;
+	size_t osize = *(size_t*)(p - LP_ARENA_HDR);
+	if (p == a->last)
+	{
+		// the most recent allocation is popped or resized in place
+		size_t start = (size_t)(p - LP_ARENA_HDR - a->cur->mem);
+		size_t need = LP_ARENA_HDR + (nsize + LP_ARENA_HDR - 1) / LP_ARENA_HDR * LP_ARENA_HDR;
+		if (nsize == 0) { a->used = start, a->last = 0; return 0; }
+		if (start + need <= a->cur->size) { a->used = start + need; *(size_t*)(p - LP_ARENA_HDR) = nsize; return p; }
+	}
+	if (nsize == 0) return 0; // freed with the arena
+	uint8_t* np = lp_arena_alloc(a, nsize);
+	memcpy(np, p, LP_MIN(osize, nsize));
+	return np;
+}
+
+#ifndef LP_ALLOC_CUSTOM
+static void* lp_alloc_at(void* ptr, size_t nsize, void* site)
+{
+	struct LPArena* a = lp_arena_bound;
+	if (nsize && lp_atomic_load(&lp_mem_tracking)) lp_mem_count(site, nsize);
+	if (a && (!ptr || lp_arena_owns(a, ptr))) return lp_arena_realloc(a, ptr, nsize);
+	return lp_heap_alloc_i(ptr, nsize, site);
+}
+void* lp_alloc(void* ptr, size_t nsize) { return lp_alloc_at(ptr, nsize, LP_RETURN_ADDRESS()); }
 #endif
 void* lp_zalloc(size_t size)
 {
+#ifdef LP_ALLOC_CUSTOM
 	void* p = lp_alloc(0, size);
+#else
+	void* p = lp_alloc_at(0, size, LP_RETURN_ADDRESS());
+#endif
 	memset(p, 0, size);
 	return p;
 }
 
+/*************************************************************************
+ * FILE MAPS
+ *
+ * Ranges start at any offset, the view begins at the page (allocation
+ * granularity on windows) below it and mem points inside. Write maps
+ * are shared, the file is grown to the bound size so it can be filled
+ * in place and cut to the real size by lp_munmap_size. A map from offset
+ * 0 rewrites the file, the cut drops its old tail; a ranged one keeps
+ * the bytes around it. Nothing is truncated up front so a map that fails
+ * leaves the file as it was. Blocks are allocated up front where the
+ * system can, a sparse file running out of space would fault in the
+ * middle of the writes instead of failing here.
+ *************************************************************************/
+
+#if defined(WIN32) || !defined(MAP_POPULATE)
+// touching a byte per page faults the range in where the system has no populate flag
+static void lp_mmap_touch(const volatile uint8_t* p, uint64_t size, uint64_t page)
+{
+	uint8_t sum = 0;
+	for (uint64_t i = 0; i < size; i += page) sum += p[i];
+	(void)sum;
+}
+#endif
+
 #ifdef WIN32
 struct LPFileMapI
 {
-	LPVOID mem;
+	uint8_t* mem;
 	uint64_t size;
+	LPVOID view;
+	uint64_t offset, keep;  // keep: file size a write map doesn't cut below
 	HANDLE file, fmap;
+	int write;
 };
-struct LPFileMap* lp_mmap(const char* filename)
+static struct LPFileMap* lp_mmap_os(const char* filename, uint64_t offset, uint64_t size, uint32_t flags)
 {
-	HANDLE hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); if (!hFile) return 0;
-	LARGE_INTEGER fsize; if (!GetFileSizeEx(hFile, &fsize)) goto fail1;
-	HANDLE hFileMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, fsize.HighPart, fsize.LowPart, NULL); if (!hFileMap) goto fail1;
-	LPVOID lpAddress = MapViewOfFile(hFileMap, FILE_MAP_READ, 0, 0, 0); if (!lpAddress) goto fail2;
-	struct LPFileMapI* m = lp_alloc(0, sizeof(*m)); m->mem = lpAddress, m->size = fsize.QuadPart, m->file = hFile, m->fmap = hFileMap;
+	int write = (flags & LP_MAP_WRITE) != 0;
+	if (write && !size) return 0;
+	HANDLE hFile = CreateFileA(filename, write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL, write ? OPEN_ALWAYS : OPEN_EXISTING,
+		flags & LP_MAP_SEQUENTIAL ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) return 0;
+	LARGE_INTEGER fsize;
+	if (!GetFileSizeEx(hFile, &fsize)) goto fail1;
+	uint64_t old = (uint64_t)fsize.QuadPart, keep = offset ? old : 0;
+	if (write) fsize.QuadPart = (LONGLONG)LP_MAX((uint64_t)fsize.QuadPart, offset + size);
+	else if ((uint64_t)fsize.QuadPart < offset) goto fail1;
+	if (!write && (!size || size > (uint64_t)fsize.QuadPart - offset)) size = (uint64_t)fsize.QuadPart - offset;
+	if (!size) goto fail1;
+	HANDLE hFileMap = CreateFileMapping(hFile, NULL, write ? PAGE_READWRITE : PAGE_READONLY, fsize.HighPart, fsize.LowPart, NULL); if (!hFileMap) goto fail1;
+	SYSTEM_INFO si; GetSystemInfo(&si);
+	uint64_t start = offset / si.dwAllocationGranularity * si.dwAllocationGranularity;
+	LPVOID view = MapViewOfFile(hFileMap, write ? FILE_MAP_WRITE : FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)(offset - start + size)); if (!view) goto fail2;
+	struct LPFileMapI* m = lp_heap_alloc(0, sizeof(*m));
+	m->mem = (uint8_t*)view + (offset - start), m->size = size, m->view = view, m->offset = offset, m->keep = keep, m->file = hFile, m->fmap = hFileMap, m->write = write;
+	if (flags & LP_MAP_POPULATE) lp_mmap_touch(m->mem, size, si.dwPageSize);
 	return (struct LPFileMap*)m;
 fail2:
 	CloseHandle(hFileMap);
+	if (write && old < offset + size) { fsize.QuadPart = (LONGLONG)old; SetFilePointerEx(hFile, fsize, NULL, FILE_BEGIN); SetEndOfFile(hFile); } // back to the size it had
 fail1:
 	CloseHandle(hFile);
 	return 0;
 }
-void lp_munmap(struct LPFileMap* fmap)
+static int lp_munmap_os(struct LPFileMap* fmap, uint64_t size)
 {
 	struct LPFileMapI* m = (struct LPFileMapI*)fmap;
-	UnmapViewOfFile(m->mem);
+	int ok = !m->write || FlushViewOfFile(m->view, 0);
+	UnmapViewOfFile(m->view);
 	CloseHandle(m->fmap);
+	if (m->write)
+	{
+		LARGE_INTEGER end; end.QuadPart = (LONGLONG)LP_MAX(m->keep, m->offset + size);
+		ok = ok && SetFilePointerEx(m->file, end, NULL, FILE_BEGIN) && SetEndOfFile(m->file);
+	}
 	CloseHandle(m->file);
+	lp_heap_alloc(m, 0);
+	return ok;
 }
 #else
 struct LPFileMapI
 {
-	void* mem;
+	uint8_t* mem;
 	uint64_t size;
-	int fd;
+	void* view;
+	size_t view_size;
+	uint64_t offset, keep;  // keep: file size a write map doesn't cut below
+	int fd, write;
 };
-struct LPFileMap* lp_mmap(const char* filename)
+static struct LPFileMap* lp_mmap_os(const char* filename, uint64_t offset, uint64_t size, uint32_t flags)
 {
-	int fd = open(filename, O_RDONLY, 0); if (fd < 0) return 0;
+	int write = (flags & LP_MAP_WRITE) != 0;
+	if (write && !size) return 0;
+	int fd = open(filename, write ? O_RDWR | O_CREAT : O_RDONLY, 0666); if (fd < 0) return 0;
 	struct stat statbuf; if (fstat(fd, &statbuf) != 0) goto fail1;
-	void* mem = mmap(0, statbuf.st_size, PROT_READ, MAP_PRIVATE | MAP_FILE, fd, 0); if (mem == MAP_FAILED) goto fail1;
-	struct LPFileMapI* m = lp_alloc(0, sizeof(*m)); m->mem = mem, m->size = statbuf.st_size, m->fd = fd;
+	uint64_t fsize = (uint64_t)statbuf.st_size, keep = offset ? fsize : 0;
+	if (!write && fsize < offset) goto fail1;
+	if (!write && (!size || size > fsize - offset)) size = fsize - offset;
+	if (!size) goto fail1;
+#ifdef __APPLE__
+	if (write && fsize < offset + size && ftruncate(fd, (off_t)(offset + size)) != 0) goto fail1;
+#else
+	if (write && posix_fallocate(fd, (off_t)offset, (off_t)size) != 0) goto fail2; // grows the file, never shrinks it
+#endif
+	uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE), start = offset / page * page;
+	int mflags = write ? MAP_SHARED : MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if (flags & LP_MAP_POPULATE) mflags |= MAP_POPULATE;
+#endif
+	void* view = mmap(0, (size_t)(offset - start + size), write ? PROT_READ | PROT_WRITE : PROT_READ, mflags | MAP_FILE, fd, (off_t)start); if (view == MAP_FAILED) goto fail2;
+	if (flags & LP_MAP_SEQUENTIAL) madvise(view, (size_t)(offset - start + size), MADV_SEQUENTIAL);
+	if (flags & LP_MAP_WILLNEED) madvise(view, (size_t)(offset - start + size), MADV_WILLNEED);
+#ifndef MAP_POPULATE
+	if (flags & LP_MAP_POPULATE) lp_mmap_touch(view, offset - start + size, page);
+#endif
+	struct LPFileMapI* m = lp_heap_alloc(0, sizeof(*m));
+	m->mem = (uint8_t*)view + (offset - start), m->size = size, m->view = view, m->view_size = (size_t)(offset - start + size);
+	m->offset = offset, m->keep = keep, m->fd = fd, m->write = write;
 	return (struct LPFileMap*)m;
+fail2:
+	if (write && fsize < offset + size) { int r = ftruncate(fd, (off_t)fsize); (void)r; } // back to the size it had
 fail1:
 	close(fd);
 	return 0;
 }
-void lp_munmap(struct LPFileMap* fmap)
+// like FlushViewOfFile the pages are left to the system to write back, no waiting on the disk per file
+static int lp_munmap_os(struct LPFileMap* fmap, uint64_t size)
 {
 	struct LPFileMapI* m = (struct LPFileMapI*)fmap;
-	munmap(m->mem, (size_t)m->size);
+	int ok = munmap(m->view, m->view_size) == 0;
+	if (m->write) ok = ftruncate(m->fd, (off_t)LP_MAX(m->keep, m->offset + size)) == 0 && ok;
 	close(m->fd);
+	lp_heap_alloc(m, 0);
+	return ok;
 }
 #endif
+struct LPFileMap* lp_mmap_ex(const char* filename, uint64_t offset, uint64_t size, uint32_t flags)
+{
+	LP_TRACE_BEGIN(trace);
+	struct LPFileMap* m = lp_mmap_os(filename, offset, size, flags);
+	LP_TRACE_END(trace, "lp_mmap");
+	return m;
+}
+int lp_munmap_size(struct LPFileMap* fmap, uint64_t size)
+{
+	LP_TRACE_BEGIN(trace);
+	int ok = lp_munmap_os(fmap, size);
+	LP_TRACE_END(trace, "lp_munmap");
+	return ok;
+}
+struct LPFileMap* lp_mmap(const char* filename) { return lp_mmap_ex(filename, 0, 0, LP_MAP_READ); }
+void lp_munmap(struct LPFileMap* fmap) { lp_munmap_size(fmap, fmap->size); }
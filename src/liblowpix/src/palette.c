@@ -2,7 +2,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
-#include "lowpix.h"
+#include "lowpix_i.h"
 
 // for parsing/writing foreign file formats, not for general editing
 #define LP_PALCC_MAX (256)
@@ -31,6 +31,40 @@ uint32_t lp_col8(uint16_t col)
 		b = (((col>>10)&31)*255 + 0xF) / 31;
 	return (uint32_t)(r | g<<8 | b<<16);
 }
+
+void lp_col5_n(uint16_t* dst, const uint32_t* src, size_t n)
+{
+	size_t i = 0;
+#ifdef LP_SSE2
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i a = lp_col5_sse2(_mm_loadu_si128((const __m128i*)(src + i)));
+		__m128i b = lp_col5_sse2(_mm_loadu_si128((const __m128i*)(src + i + 4)));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(a, b));
+	}
+#endif
+	for (; i < n; ++i) dst[i] = lp_col5(src[i]);
+}
+// (c*255 + 15) / 31 as a multiply-shift, identical to lp_col8
+void lp_col8_n(uint32_t* dst, const uint16_t* src, size_t n)
+{
+	size_t i = 0;
+#ifdef LP_SSE2
+	const __m128i m31 = _mm_set1_epi16(31), m255 = _mm_set1_epi16(255), r15 = _mm_set1_epi16(15), d31 = _mm_set1_epi16((short)0x8422);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i r = _mm_and_si128(v, m31), g = _mm_and_si128(_mm_srli_epi16(v, 5), m31), b = _mm_and_si128(_mm_srli_epi16(v, 10), m31);
+		r = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(r, m255), r15), d31), 4);
+		g = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(g, m255), r15), d31), 4);
+		b = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(b, m255), r15), d31), 4);
+		__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(rg, b));
+		_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(rg, b));
+	}
+#endif
+	for (; i < n; ++i) dst[i] = lp_col8(src[i]);
+}
 uint32_t lp_colf(float r, float g, float b)
 { return (uint32_t)(r*255+0.5f) | (uint32_t)(g*255+0.5f)<<8 | (uint32_t)(b*255+0.5f)<<16; }
 uint32_t lp_col_lerp(uint32_t col1, uint32_t col2, float x)
@@ -41,84 +75,221 @@ uint32_t lp_col_lerp(uint32_t col1, uint32_t col2, float x)
 	return lp_colf(r, g, b);
 }
 
-static void lp_pal_save_bin(struct LPPalette* pal, FILE* f, const char* name, const char* h)
+static void lp_pal_save_bin(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name)
 {
+	(void)wh; (void)name;
+	lp_w_reserve(w, pal->col_count * 3);
 	for (uint32_t i = 0; i < pal->col_count; ++i)
 	{
 		uint8_t b[3] = { pal->col[i] & 0xFF, (pal->col[i]>>8) & 0xFF, (pal->col[i]>>16) & 0xFF };
-		fwrite(b, 1, 3, f);
+		lp_w_write(w, b, 3);
 	}
 }
-static void lp_pal_save_act(struct LPPalette* pal, FILE* f, const char* name, const char* h)
+static void lp_pal_save_act(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name)
 {
+	(void)wh; (void)name;
 	uint32_t i;
 	for (i = 0; i < pal->col_count && i < 256; ++i)
 	{
 		uint8_t b[3] = { pal->col[i] & 0xFF, (pal->col[i]>>8) & 0xFF, (pal->col[i]>>16) & 0xFF };
-		fwrite(b, 1, 3, f);
+		lp_w_write(w, b, 3);
 	}
-	uint32_t v = 0;
 	for (; i < 256; ++i)
-		fwrite(&v, 1, 3, f);
+		lp_w_write(w, "\0\0\0", 3);
 }
-static void lp_pal_save_gpl(struct LPPalette* pal, FILE* f, const char* name, const char* h)
+static void lp_pal_save_gpl(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name)
 {
-	fprintf(f, "GIMP Palette\nName: %s\nColumns: 0\n#\n", name);
+	(void)wh;
+	lp_w_str(w, "GIMP Palette\nName: "); lp_w_str(w, name); lp_w_str(w, "\nColumns: 0\n#\n");
 	for (uint32_t i = 0; i < pal->col_count; ++i)
-		fprintf(f, "%*d %*d %*d Untitled\n", 3, pal->col[i] & 0xFF, 3, (pal->col[i]>>8) & 0xFF, 3, (pal->col[i]>>16) & 0xFF);
+	{
+		lp_w_dec(w, pal->col[i] & 0xFF, 3); lp_w_putc(w, ' ');
+		lp_w_dec(w, (pal->col[i]>>8) & 0xFF, 3); lp_w_putc(w, ' ');
+		lp_w_dec(w, (pal->col[i]>>16) & 0xFF, 3); lp_w_str(w, " Untitled\n");
+	}
+}
+// include guard and declarations shared by the .s header and the .c file
+static void lp_pal_save_decl(struct LPPalette* pal, struct LPWriter* w, const char* name, const char* uname)
+{
+	lp_w_str(w, "#ifndef LPGEN_"); lp_w_str(w, uname); lp_w_str(w, "_H\n#define LPGEN_"); lp_w_str(w, uname);
+	lp_w_str(w, "_H\n\n#define "); lp_w_str(w, name); lp_w_str(w, "_size ("); lp_w_dec(w, pal->col_count*2, 0);
+	lp_w_str(w, ")\nextern const u16 "); lp_w_str(w, name); lp_w_str(w, "[0x"); lp_w_hex(w, pal->col_count, 1);
+	lp_w_str(w, "];\n\n#endif\n");
 }
-static void lp_pal_save_asm(struct LPPalette* pal, FILE* f, const char* name, const char* h)
+// 16 bit hex table, 8 per line, each line opened by prefix and values separated by commas
+static void lp_pal_save_hwords(struct LPPalette* pal, struct LPWriter* w, const char* prefix, int trailing)
 {
-	fprintf(f, "\t.section .rodata\n\t.align 2\n\t.global %s\n\t.hidden %s\n%s:", name, name, name);
+	struct LPArena* scratch = lp_scratch();
+	size_t mark = lp_arena_mark(scratch);
+	uint16_t* c5 = lp_arena_alloc(scratch, pal->col_count * sizeof(*c5));
+	lp_col5_n(c5, pal->col, pal->col_count);
+	size_t plen = strlen(prefix);
 	for (uint32_t i = 0; i < pal->col_count; ++i)
 	{
-		if (i%8 == 0) fprintf(f, "\n\t.hword ");
-		fprintf(f, "0x%04X%s", lp_col5(pal->col[i]), (i+1)%8==0 || i == pal->col_count - 1 ? "" : ",");
+		lp_w_reserve(w, plen + 7);
+		if (i%8 == 0) lp_w_write(w, prefix, plen);
+		lp_w_putc(w, '0'); lp_w_putc(w, 'x'); lp_w_hex(w, c5[i], 4);
+		if (i < pal->col_count - 1 && (trailing || (i+1)%8 != 0)) lp_w_putc(w, ',');
 	}
-	FILE* fh = fopen(h, "wb");
-	if (fh)
+	lp_arena_rewind(scratch, mark);
+}
+static void lp_pal_upper(char* uname, const char* name) { for (size_t i = 0; i <= strlen(name); ++i) uname[i] = (char)toupper(name[i]); }
+static void lp_pal_save_asm(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name)
+{
+	lp_w_str(w, "\t.section .rodata\n\t.align 2\n\t.global "); lp_w_str(w, name);
+	lp_w_str(w, "\n\t.hidden "); lp_w_str(w, name); lp_w_putc(w, '\n'); lp_w_str(w, name); lp_w_putc(w, ':');
+	lp_pal_save_hwords(pal, w, "\n\t.hword ", 0);
+	if (wh)
 	{
-		char uname[256]; for (int i = 0; i <= strlen(name); ++i) uname[i] = (char)toupper(name[i]);
-		fprintf(fh, "#ifndef LPGEN_%s_H\n#define LPGEN_%s_H\n\n#define %s_size (%d)\nextern const u16 %s[0x%X];\n\n#endif\n",
-			uname, uname, name, pal->col_count*2, name, pal->col_count);
-		fclose(fh);
+		char uname[256]; lp_pal_upper(uname, name);
+		lp_pal_save_decl(pal, wh, name, uname);
 	}
 }
-static void lp_pal_save_c(struct LPPalette* pal, FILE* f, const char* name, const char* h)
+static void lp_pal_save_c(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name)
 {
-	char uname[256]; for (int i = 0; i <= strlen(name); ++i) uname[i] = (char)toupper(name[i]);
-	fprintf(f, "#ifndef LPGEN_%s_H\n#define LPGEN_%s_H\n\n#define %s_size (%d)\nextern const u16 %s[0x%X];\n\n#endif\n\n#ifdef %s_IMPLEMENTATION\n\nu16 %s[%d] = {",
-			uname, uname, name, pal->col_count*2, name, pal->col_count, uname, name, pal->col_count);
-	for (uint32_t i = 0; i < pal->col_count; ++i)
-		fprintf(f, "%s0x%04X%s", i%8==0 ? "\n\t" : "", lp_col5(pal->col[i]), i < pal->col_count - 1 ? "," : "");
-	fprintf(f, "\n};\n\n#endif\n");
+	(void)wh;
+	char uname[256]; lp_pal_upper(uname, name);
+	lp_pal_save_decl(pal, w, name, uname);
+	lp_w_str(w, "\n#ifdef "); lp_w_str(w, uname); lp_w_str(w, "_IMPLEMENTATION\n\nu16 "); lp_w_str(w, name);
+	lp_w_putc(w, '['); lp_w_dec(w, pal->col_count, 0); lp_w_str(w, "] = {");
+	lp_pal_save_hwords(pal, w, "\n\t", 1);
+	lp_w_str(w, "\n};\n\n#endif\n");
 }
-int lp_pal_save(struct LPPalette* pal, const char* fn, enum LPPaletteFormat format)
+// relocatable ARM ELF32: .rodata with the RGB555 table, symbols <name> and <name>_size (absolute)
+static void lp_w_le(struct LPWriter* w, uint32_t v, int n) { lp_w_reserve(w, n); while (n--) w->buf[w->pos++] = (uint8_t)v, v >>= 8; }
+static void lp_elf_shdr(struct LPWriter* w, uint32_t name, uint32_t type, uint32_t flags, uint32_t off, uint32_t sz, uint32_t link, uint32_t info, uint32_t align, uint32_t entsz)
+{
+	lp_w_le(w, name, 4); lp_w_le(w, type, 4); lp_w_le(w, flags, 4); lp_w_le(w, 0, 4); lp_w_le(w, off, 4);
+	lp_w_le(w, sz, 4); lp_w_le(w, link, 4); lp_w_le(w, info, 4); lp_w_le(w, align, 4); lp_w_le(w, entsz, 4);
+}
+static void lp_elf_sym(struct LPWriter* w, uint32_t name, uint32_t value, uint32_t sz, uint8_t info, uint8_t other, uint16_t shndx)
+{ lp_w_le(w, name, 4); lp_w_le(w, value, 4); lp_w_le(w, sz, 4); lp_w_putc(w, (char)info); lp_w_putc(w, (char)other); lp_w_le(w, shndx, 2); }
+static void lp_pal_save_elf(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name)
+{
+	enum { SHT_PROGBITS = 1, SHT_SYMTAB = 2, SHT_STRTAB = 3, SHF_ALLOC = 2, STB_GLOBAL = 1, STT_OBJECT = 1, STV_HIDDEN = 2, SHN_ABS = 0xFFF1 };
+	static const char shstr[] = "\0.rodata\0.symtab\0.strtab\0.shstrtab";
+	uint32_t nlen = (uint32_t)strlen(name), data_sz = pal->col_count * 2;
+	uint32_t data_off = 52, sym_off = (data_off + data_sz + 3) & ~3u, sym_sz = 3*16;
+	uint32_t str_off = sym_off + sym_sz, str_sz = 1 + nlen+1 + nlen+6;
+	uint32_t shstr_off = str_off + str_sz, sh_off = (shstr_off + sizeof(shstr) + 3) & ~3u;
+	// header
+	lp_w_write(w, "\x7F" "ELF\x01\x01\x01\0\0\0\0\0\0\0\0\0", 16); // 32 bit, little endian
+	lp_w_le(w, 1, 2); lp_w_le(w, 40, 2); lp_w_le(w, 1, 4); // ET_REL, EM_ARM
+	lp_w_le(w, 0, 4); lp_w_le(w, 0, 4); lp_w_le(w, sh_off, 4); lp_w_le(w, 0x05000000, 4); // EABI version 5
+	lp_w_le(w, 52, 2); lp_w_le(w, 0, 2); lp_w_le(w, 0, 2); lp_w_le(w, 40, 2); lp_w_le(w, 5, 2); lp_w_le(w, 4, 2);
+	// .rodata
+	struct LPArena* scratch = lp_scratch();
+	size_t mark = lp_arena_mark(scratch);
+	uint16_t* c5 = lp_arena_alloc(scratch, pal->col_count * sizeof(*c5));
+	lp_col5_n(c5, pal->col, pal->col_count);
+	lp_w_reserve(w, data_sz);
+	for (uint32_t i = 0; i < pal->col_count; ++i) w->buf[w->pos++] = (uint8_t)c5[i], w->buf[w->pos++] = (uint8_t)(c5[i] >> 8);
+	lp_arena_rewind(scratch, mark);
+	lp_w_write(w, "\0\0\0", sym_off - data_off - data_sz);
+	// .symtab, .strtab
+	lp_elf_sym(w, 0, 0, 0, 0, 0, 0);
+	lp_elf_sym(w, 1, 0, data_sz, STB_GLOBAL<<4 | STT_OBJECT, STV_HIDDEN, 1);
+	lp_elf_sym(w, 1 + nlen+1, data_sz, 0, STB_GLOBAL<<4, STV_HIDDEN, SHN_ABS);
+	lp_w_putc(w, 0); lp_w_write(w, name, nlen+1); lp_w_write(w, name, nlen); lp_w_write(w, "_size", 6);
+	// .shstrtab, section headers
+	lp_w_write(w, shstr, sizeof(shstr));
+	lp_w_write(w, "\0\0\0", sh_off - shstr_off - sizeof(shstr));
+	lp_elf_shdr(w, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	lp_elf_shdr(w, 1, SHT_PROGBITS, SHF_ALLOC, data_off, data_sz, 0, 0, 4, 0);
+	lp_elf_shdr(w, 9, SHT_SYMTAB, 0, sym_off, sym_sz, 3, 1, 4, 16);
+	lp_elf_shdr(w, 17, SHT_STRTAB, 0, str_off, str_sz, 0, 0, 1, 0);
+	lp_elf_shdr(w, 25, SHT_STRTAB, 0, shstr_off, sizeof(shstr), 0, 0, 1, 0);
+	if (wh)
+	{
+		char uname[256]; lp_pal_upper(uname, name);
+		lp_pal_save_decl(pal, wh, name, uname);
+	}
+}
+static const int lp_pal_has_h[] = { 0, 0, 0, 1, 0, 1 };
+int lp_pal_write(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name, enum LPPaletteFormat format)
+{
+	if (!pal || !w || pal->col_count <= 0 || format < 0 || format > LP_PALETTEFORMAT_ELF) return 0;
+	if (strlen(name) >= 256) return 0;
+	static void (*writers[])(struct LPPalette* pal, struct LPWriter* w, struct LPWriter* wh, const char* name) = { lp_pal_save_bin, lp_pal_save_act, lp_pal_save_gpl, lp_pal_save_asm, lp_pal_save_c, lp_pal_save_elf };
+	writers[format](pal, w, wh, name);
+	return !w->error && (!wh || !wh->error);
+}
+// h receives the companion header path of formats that have one, free with lp_alloc(h, 0)
+static int lp_pal_save_i(struct LPPalette* pal, const char* fn, enum LPPaletteFormat format, char** h_fn)
 {
 	if (pal->col_count <= 0) return 0;
 	char name[256];
-	size_t len = strlen(fn), name_s = 0, name_e = len, i;
-	for (size_t i = name_e; i >= 0; --i) { if (fn[i] == '.') name_e = i; if (fn[i] == '/' || fn[i] == LP_SECPATHSEP) { name_s = i+1; break; } }
+	size_t len = strlen(fn), name_s = 0, name_e = len;
+	for (size_t i = len; i-- > 0;) { if (fn[i] == '.') name_e = i; if (fn[i] == '/' || fn[i] == LP_SECPATHSEP) { name_s = i+1; break; } }
 	if (name_s >= name_e || name_e - name_s >= sizeof(name)) return 0;
 	strncpy(name, fn + name_s, name_e - name_s);
 	name[name_e - name_s] = 0;
 	if (format == LP_PALETTEFORMAT_EXT)
 	{
 		if (name_e <= 0 || name_e >= len - 1) return 0;
-		static const char* exts[] = { "bin", "act", "gpl", "s", "c" };
+		static const char* exts[] = { "bin", "act", "gpl", "s", "c", "o" };
 		format = LP_PALETTEFORMAT_BIN;
 		for (int i = 0; i < sizeof(exts) / sizeof(*exts); ++i) { if (strncmp(exts[i], fn + name_e + 1, strlen(exts[i])) == 0) { format = (enum LPPaletteFormat)i; break; } }
 	}
-	FILE* f = fopen(fn, "wb"); if (!f) return 0;
-	char* h = lp_alloc(0, strlen(fn)+3);
-	strcpy(h, fn);
-	for (i = len-1; i >= 0; --i) { if (h[i] == '.') { h[i+1] = 'h'; h[i+2] = 0; break; } }
-	if (i < 0) h[len] = '.', h[len+1] = 'h', h[len+2] = 0;
-	static void (*writers[])(struct LPPalette* pal, FILE* f, const char* name, const char* fn) = { lp_pal_save_bin, lp_pal_save_act, lp_pal_save_gpl, lp_pal_save_asm, lp_pal_save_c };
-	writers[format](pal, f, name, h);
+	struct LPWriter* w = lp_w_open(fn); if (!w) return 0;
+	struct LPWriter* wh = 0;
+	if (lp_pal_has_h[format])
+	{
+		const char* ext = strrchr(fn + name_s, '.');
+		size_t base = ext ? (size_t)(ext - fn) : len;
+		char* h = lp_alloc(0, base + 3);
+		memcpy(h, fn, base);
+		h[base] = '.', h[base+1] = 'h', h[base+2] = 0;
+		wh = lp_w_open(h);
+		if (h_fn) *h_fn = h;
+		else lp_alloc(h, 0);
+	}
+	int ok = lp_pal_write(pal, w, wh, name, format);
+	if (wh) lp_w_close(wh);
+	return lp_w_close(w) && ok;
+}
+int lp_pal_save(struct LPPalette* pal, const char* fn, enum LPPaletteFormat format)
+{
+	LP_TRACE_BEGIN(trace);
+	int ok = lp_pal_save_i(pal, fn, format, 0);
+	LP_TRACE_END(trace, "lp_pal_save");
+	return ok;
+}
+int lp_pal_save_dep(struct LPPalette* pal, const char* fn, enum LPPaletteFormat format, const char* const* deps, uint32_t dep_count)
+{
+	LP_TRACE_BEGIN(trace);
+	char* h = 0;
+	int ok = lp_pal_save_i(pal, fn, format, &h);
+	if (ok)
+	{
+		const char* targets[2] = { fn, h };
+		char* dep_fn = lp_alloc(0, strlen(fn) + 3);
+		strcpy(dep_fn, fn); strcat(dep_fn, ".d");
+		ok = lp_dep_save(dep_fn, targets, h ? 2 : 1, deps, dep_count);
+		lp_alloc(dep_fn, 0);
+	}
 	lp_alloc(h, 0);
-	fclose(f);
-	return 1;
+	LP_TRACE_END(trace, "lp_pal_save_dep");
+	return ok;
+}
+void* lp_pal_save_mem(struct LPPalette* pal, const char* name, enum LPPaletteFormat format, size_t* sz, void** h, size_t* h_sz)
+{
+	if (h) *h = 0;
+	if (h_sz) *h_sz = 0;
+	LP_TRACE_BEGIN(trace);
+	struct LPWriter* w = lp_w_mem();
+	struct LPWriter* wh = h && format >= 0 && format <= LP_PALETTEFORMAT_ELF && lp_pal_has_h[format] ? lp_w_mem() : 0;
+	if (!lp_pal_write(pal, w, wh, name, format))
+	{
+		lp_alloc(lp_w_close_mem(w, 0), 0);
+		if (wh) lp_alloc(lp_w_close_mem(wh, 0), 0);
+		LP_TRACE_END(trace, "lp_pal_save_mem");
+		return 0;
+	}
+	if (wh) *h = lp_w_close_mem(wh, h_sz);
+	void* data = lp_w_close_mem(w, sz);
+	LP_TRACE_END(trace, "lp_pal_save_mem");
+	return data;
 }
 
 static struct LPPalette* lp_pal_load_pal(uint8_t* data, size_t sz) // microsoft .pal
@@ -270,37 +441,46 @@ struct LPPalette* lp_pal_load_i(const char* fn, void* data, size_t sz)
 }
 struct LPPalette* lp_pal_load(const char* fn, void* data, size_t sz)
 {
+	LP_TRACE_BEGIN(trace);
 	struct LPFileMap* fmap = 0;
 	if (fn && !data)
 	{
-		if (!(fmap = lp_mmap(fn))) return 0;
+		if (!(fmap = lp_mmap(fn))) { LP_TRACE_END(trace, "lp_pal_load"); return 0; }
 		data = fmap->mem, sz = fmap->size;
 	}
+	LP_TRACE_BEGIN(trace_parse);
 	struct LPPalette* pal = lp_pal_load_i(fn, data, sz);
+	LP_TRACE_END(trace_parse, "pal parse");
 	if (fmap) lp_munmap(fmap);
+	LP_TRACE_END(trace, "lp_pal_load");
 	return pal;
 }
 
 struct LPPalette* lp_pal_clone(struct LPPalette* pal)
 {
+	LP_TRACE_BEGIN(trace);
 	struct LPPalette* npal = lp_alloc(0, offsetof(struct LPPalette, col[pal->col_count]));
 	npal->col_count = pal->col_count;
 	memcpy(npal->col, pal->col, pal->col_count * sizeof(*pal->col));
+	LP_TRACE_END(trace, "lp_pal_clone");
 	return npal;
 }
 
 struct LPPalette* lp_pal_concat(struct LPPalette* pal1, struct LPPalette* pal2)
 {
+	LP_TRACE_BEGIN(trace);
 	uint32_t cc = pal1->col_count + pal2->col_count;
 	struct LPPalette* pal = lp_alloc(0, offsetof(struct LPPalette, col[cc]));
 	pal->col_count = cc;
 	memcpy(pal->col, pal1->col, pal1->col_count * sizeof(*pal->col));
 	memcpy(pal->col + pal1->col_count, pal2->col, pal2->col_count * sizeof(*pal->col));
+	LP_TRACE_END(trace, "lp_pal_concat");
 	return pal;
 }
 
 struct LPPalette* lp_pal_unique(struct LPPalette* pal)
 {
+	LP_TRACE_BEGIN(trace);
 	struct LPPalette* npal = lp_alloc(0, offsetof(struct LPPalette, col[pal->col_count]));
 	npal->col_count = 0;
 	for (uint32_t i = 0; i < pal->col_count; ++i)
@@ -309,20 +489,29 @@ struct LPPalette* lp_pal_unique(struct LPPalette* pal)
 		for (j = 0; j < npal->col_count && pal->col[i] != npal->col[j]; ++j);
 		if (j == npal->col_count) npal->col[npal->col_count++] = pal->col[i];
 	}
-	return lp_alloc(npal, offsetof(struct LPPalette, col[npal->col_count]));
+	npal = lp_alloc(npal, offsetof(struct LPPalette, col[npal->col_count]));
+	LP_TRACE_END(trace, "lp_pal_unique");
+	return npal;
 }
 
 struct LPPalette* lp_pal_restrict(struct LPPalette* pal)
 {
+	LP_TRACE_BEGIN(trace);
 	struct LPPalette* npal = lp_alloc(0, offsetof(struct LPPalette, col[pal->col_count]));
 	npal->col_count = pal->col_count;
-	for (uint32_t i = 0; i < pal->col_count; ++i)
-		npal->col[i] = lp_col8(lp_col5(pal->col[i]));
+	struct LPArena* scratch = lp_scratch();
+	size_t mark = lp_arena_mark(scratch);
+	uint16_t* c5 = lp_arena_alloc(scratch, pal->col_count * sizeof(*c5));
+	lp_col5_n(c5, pal->col, pal->col_count);
+	lp_col8_n(npal->col, c5, pal->col_count);
+	lp_arena_rewind(scratch, mark);
+	LP_TRACE_END(trace, "lp_pal_restrict");
 	return npal;
 }
 
 struct LPPalette* lp_pal_lerp(struct LPPalette* pal1, struct LPPalette* pal2, float x)
 {
+	LP_TRACE_BEGIN(trace);
 	uint32_t cc = pal1->col_count > pal2->col_count ? pal1->col_count : pal2->col_count;
 	struct LPPalette* pal = lp_alloc(0, offsetof(struct LPPalette, col[cc]));
 	pal->col_count = cc;
@@ -332,5 +521,6 @@ struct LPPalette* lp_pal_lerp(struct LPPalette* pal1, struct LPPalette* pal2, fl
 		uint32_t col2 = i < pal2->col_count ? pal2->col[i] : pal1->col[i];
 		pal->col[i] = lp_col_lerp(col1, col2, x);
 	}
+	LP_TRACE_END(trace, "lp_pal_lerp");
 	return pal;
 }
@@ -0,0 +1,350 @@
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * THREAD POOL
+ *
+ * Work stealing: each worker owns a deque, pushes and pops its own end
+ * and steals from the other end of the others. Threads outside the
+ * pool submit to a shared queue. Deques are small spinlocked rings,
+ * when one is full the task goes on a spill list every thread checks
+ * after the deques, a submit never runs the task itself. There is at
+ * least one worker even on a single hardware thread, so work submitted
+ * from a thread that mustn't block (the editor's) still runs beside it.
+ * Waiting on a job runs queued tasks meanwhile, so jobs can be nested
+ * and the caller of lp_parallel_for takes part in the work. Idle
+ * workers sleep on a condition variable until a submit wakes them:
+ * a sleeper counts itself then checks queued under the mutex, a submit
+ * counts the task then checks sleepers, both sequentially consistent,
+ * so one of them always sees the other and no wake up is lost.
+ *************************************************************************/
+
+#define LP_THREAD_MAX   (64)
+#define LP_DEQUE_SIZE   (1024)  // power of 2
+#define LP_WORKER_SPIN  (256)   // empty polls before sleeping
+
+static uint32_t lp_thread_count_set = 0;
+void lp_thread_set_count(uint32_t count) { lp_thread_count_set = count > LP_THREAD_MAX ? LP_THREAD_MAX : count; }
+static uint32_t lp_thread_hw(void)
+{
+	static uint32_t count = 0;
+	if (count) return count;
+#ifdef WIN32
+	SYSTEM_INFO si; GetSystemInfo(&si);
+	long n = (long)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	count = n < 1 ? 1 : n > LP_THREAD_MAX ? LP_THREAD_MAX : (uint32_t)n;
+	return count;
+}
+// the override only caps, the pool is sized once for the hardware whatever the count was when it started
+uint32_t lp_thread_count(void) { return lp_thread_count_set ? LP_MIN(lp_thread_count_set, lp_thread_hw()) : lp_thread_hw(); }
+
+uint64_t lp_time_ns(void)
+{
+#ifdef WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (uint64_t)(t.QuadPart / freq.QuadPart) * 1000000000u + (uint64_t)(t.QuadPart % freq.QuadPart) * 1000000000u / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void lp_thread_yield(void)
+{
+#ifdef WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+struct LPJob
+{
+	uint32_t pending;       // submitted tasks not finished yet
+	uint32_t cancel;
+};
+struct LPTask
+{
+	void (*fn)(void* user, uint32_t ix);
+	void* user;
+	uint32_t ix;
+	struct LPJob* job;
+};
+struct LPDeque
+{
+	uint32_t lock;
+	uint32_t top, bottom;   // tasks in [top, bottom), indices wrap
+	struct LPTask task[LP_DEQUE_SIZE];
+};
+struct LPSpill
+{
+	struct LPSpill* next;
+	struct LPTask task;
+};
+static struct
+{
+	uint32_t state;         // 0 not started, 1 starting, 2 running
+	uint32_t worker_count;
+	uint32_t queued;        // tasks in all deques
+	uint32_t sleepers;
+	struct LPDeque shared;  // submissions from outside the pool
+	struct LPDeque* worker;
+	uint32_t spill_lock;
+	struct LPSpill *spill, *spill_last; // overflow of full deques, oldest first
+#ifdef WIN32
+	CRITICAL_SECTION mutex;
+	CONDITION_VARIABLE cond;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+} lp_pool;
+static LP_TLS int lp_worker_ix = -1;
+static LP_TLS uint32_t lp_worker_rand = 0;
+
+static void lp_deque_lock(struct LPDeque* d) { while (!lp_atomic_cas(&d->lock, 0, 1)) lp_cpu_relax(); }
+static void lp_deque_unlock(struct LPDeque* d) { lp_atomic_store(&d->lock, 0); }
+static int lp_deque_push(struct LPDeque* d, const struct LPTask* t)
+{
+	lp_deque_lock(d);
+	int ok = d->bottom - d->top < LP_DEQUE_SIZE;
+	if (ok) d->task[d->bottom & (LP_DEQUE_SIZE - 1)] = *t, lp_atomic_store(&d->bottom, d->bottom + 1);
+	lp_deque_unlock(d);
+	return ok;
+}
+// the ends are stored atomically since the early out reads them without the lock
+static int lp_deque_pop(struct LPDeque* d, struct LPTask* t, int steal)
+{
+	if (lp_atomic_load(&d->bottom) == lp_atomic_load(&d->top)) return 0; // cheap early out, rechecked under the lock
+	lp_deque_lock(d);
+	int ok = d->bottom != d->top;
+	if (ok && steal) *t = d->task[d->top & (LP_DEQUE_SIZE - 1)], lp_atomic_store(&d->top, d->top + 1);
+	else if (ok) lp_atomic_store(&d->bottom, d->bottom - 1), *t = d->task[d->bottom & (LP_DEQUE_SIZE - 1)];
+	lp_deque_unlock(d);
+	return ok;
+}
+static void lp_spill_push(const struct LPTask* t)
+{
+	struct LPSpill* s = lp_raw_alloc(0, sizeof(*s));
+	s->next = 0, s->task = *t;
+	while (!lp_atomic_cas(&lp_pool.spill_lock, 0, 1)) lp_cpu_relax();
+	if (lp_pool.spill_last) lp_pool.spill_last->next = s;
+	else lp_atomic_store_ptr(&lp_pool.spill, s);
+	lp_pool.spill_last = s;
+	lp_atomic_store(&lp_pool.spill_lock, 0);
+}
+static int lp_spill_pop(struct LPTask* t)
+{
+	if (!lp_atomic_load_ptr(&lp_pool.spill)) return 0; // cheap early out, rechecked under the lock
+	while (!lp_atomic_cas(&lp_pool.spill_lock, 0, 1)) lp_cpu_relax();
+	struct LPSpill* s = lp_pool.spill;
+	if (s)
+	{
+		lp_atomic_store_ptr(&lp_pool.spill, s->next);
+		if (!s->next) lp_pool.spill_last = 0;
+	}
+	lp_atomic_store(&lp_pool.spill_lock, 0);
+	if (!s) return 0;
+	*t = s->task;
+	lp_raw_alloc(s, 0);
+	return 1;
+}
+
+// tasks run with no arena bound, a helping thread's arena belongs to the job it is waiting in
+static void lp_task_run(struct LPTask* t)
+{
+	struct LPArena* a = lp_arena_bind(0);
+	if (!lp_atomic_load(&t->job->cancel)) t->fn(t->user, t->ix);
+	lp_arena_bind(a);
+	lp_atomic_add(&t->job->pending, (uint32_t)-1);
+}
+// own deque first (most recent, cache warm), then the shared queue and the spill list, then steal from a random worker
+static int lp_task_find(struct LPTask* t)
+{
+	if (lp_atomic_load(&lp_pool.queued) == 0) return 0;
+	int found = (lp_worker_ix >= 0 && lp_deque_pop(&lp_pool.worker[lp_worker_ix], t, 0)) || lp_deque_pop(&lp_pool.shared, t, 1) || lp_spill_pop(t);
+	if (!found)
+	{
+		uint32_t r = lp_worker_rand = lp_worker_rand * 1664525u + 1013904223u, n = lp_pool.worker_count;
+		for (uint32_t i = 0; i < n && !found; ++i)
+			if ((int)((r + i) % n) != lp_worker_ix) found = lp_deque_pop(&lp_pool.worker[(r + i) % n], t, 1);
+	}
+	if (found) lp_atomic_add(&lp_pool.queued, (uint32_t)-1);
+	return found;
+}
+int lp_thread_help(void)
+{
+	struct LPTask t;
+	if (lp_atomic_load(&lp_pool.state) != 2 || !lp_task_find(&t)) return 0;
+	lp_task_run(&t);
+	return 1;
+}
+
+static void lp_worker_loop(int ix)
+{
+	lp_worker_ix = ix;
+	lp_worker_rand = (uint32_t)ix * 2654435761u + 1;
+	for (int idle = 0;;)
+	{
+		struct LPTask t;
+		if (lp_task_find(&t)) { lp_task_run(&t); idle = 0; continue; }
+		if (++idle < LP_WORKER_SPIN) { lp_cpu_relax(); continue; }
+		idle = 0;
+#ifdef WIN32
+		EnterCriticalSection(&lp_pool.mutex);
+		lp_atomic_add_sc(&lp_pool.sleepers, 1);
+		if (lp_atomic_load_sc(&lp_pool.queued) == 0) SleepConditionVariableCS(&lp_pool.cond, &lp_pool.mutex, INFINITE);
+		lp_atomic_add(&lp_pool.sleepers, (uint32_t)-1);
+		LeaveCriticalSection(&lp_pool.mutex);
+#else
+		pthread_mutex_lock(&lp_pool.mutex);
+		lp_atomic_add_sc(&lp_pool.sleepers, 1);
+		if (lp_atomic_load_sc(&lp_pool.queued) == 0) pthread_cond_wait(&lp_pool.cond, &lp_pool.mutex);
+		lp_atomic_add(&lp_pool.sleepers, (uint32_t)-1);
+		pthread_mutex_unlock(&lp_pool.mutex);
+#endif
+	}
+}
+#ifdef WIN32
+static DWORD WINAPI lp_worker_thread(LPVOID p) { lp_worker_loop((int)(intptr_t)p); return 0; }
+#else
+static void* lp_worker_thread(void* p) { lp_worker_loop((int)(intptr_t)p); return 0; }
+#endif
+
+// workers are started on first use, one less than the hardware threads since the waiting thread works too,
+// but at least one; the deques live until exit and stay out of lp_mem_report
+static void lp_pool_start(void)
+{
+	if (lp_atomic_load(&lp_pool.state) == 2) return;
+	if (!lp_atomic_cas(&lp_pool.state, 0, 1))
+	{
+		while (lp_atomic_load(&lp_pool.state) != 2) lp_thread_yield();
+		return;
+	}
+	uint32_t n = LP_MAX(lp_thread_hw() - 1, 1), i;
+	lp_pool.worker = lp_raw_alloc(0, n * sizeof(*lp_pool.worker));
+	memset(lp_pool.worker, 0, n * sizeof(*lp_pool.worker));
+#ifdef WIN32
+	InitializeCriticalSection(&lp_pool.mutex);
+	InitializeConditionVariable(&lp_pool.cond);
+	for (i = 0; i < n; ++i)
+	{
+		HANDLE th = CreateThread(0, 0, lp_worker_thread, (LPVOID)(intptr_t)i, 0, 0);
+		if (!th) break;
+		CloseHandle(th);
+	}
+#else
+	pthread_mutex_init(&lp_pool.mutex, 0);
+	pthread_cond_init(&lp_pool.cond, 0);
+	for (i = 0; i < n; ++i)
+	{
+		pthread_t th;
+		if (pthread_create(&th, 0, lp_worker_thread, (void*)(intptr_t)i) != 0) break;
+		pthread_detach(th);
+	}
+#endif
+	lp_pool.worker_count = i; // deques of workers that failed to start are never used
+	lp_atomic_store(&lp_pool.state, 2);
+}
+
+static void lp_job_submit_i(struct LPJob* job, void (*fn)(void* user, uint32_t ix), void* user, uint32_t ix)
+{
+	struct LPTask t = { fn, user, ix, job };
+	lp_pool_start();
+	lp_atomic_add(&job->pending, 1);
+	struct LPDeque* d = lp_worker_ix >= 0 ? &lp_pool.worker[lp_worker_ix] : &lp_pool.shared;
+	if (lp_pool.worker_count == 0) { lp_task_run(&t); return; } // no thread could be started
+	if (!lp_deque_push(d, &t)) lp_spill_push(&t);
+	lp_atomic_add_sc(&lp_pool.queued, 1);
+	if (lp_atomic_load_sc(&lp_pool.sleepers))
+	{
+#ifdef WIN32
+		EnterCriticalSection(&lp_pool.mutex);
+		WakeConditionVariable(&lp_pool.cond);
+		LeaveCriticalSection(&lp_pool.mutex);
+#else
+		pthread_mutex_lock(&lp_pool.mutex);
+		pthread_cond_signal(&lp_pool.cond);
+		pthread_mutex_unlock(&lp_pool.mutex);
+#endif
+	}
+}
+static void lp_job_wait_i(struct LPJob* job)
+{
+	for (int spin = 0; lp_atomic_load(&job->pending) != 0;)
+	{
+		if (lp_thread_help()) spin = 0;
+		else if (++spin < 64) lp_cpu_relax();
+		else lp_thread_yield();
+	}
+}
+
+// jobs are often waited on by another thread than the one that made them, so never from an arena
+struct LPJob* lp_job_new(void) { return memset(lp_heap_alloc(0, sizeof(struct LPJob)), 0, sizeof(struct LPJob)); }
+void lp_job_submit(struct LPJob* job, void (*fn)(void* user, uint32_t ix), void* user, uint32_t ix) { lp_job_submit_i(job, fn, user, ix); }
+void lp_job_for(struct LPJob* job, uint32_t count, void (*fn)(void* user, uint32_t ix), void* user)
+{
+	for (uint32_t i = 0; i < count; ++i) lp_job_submit_i(job, fn, user, i);
+}
+void lp_job_cancel(struct LPJob* job) { lp_atomic_store(&job->cancel, 1); }
+int lp_job_cancelled(struct LPJob* job) { return lp_atomic_load(&job->cancel) != 0; }
+int lp_job_done(struct LPJob* job) { return lp_atomic_load(&job->pending) == 0; }
+int lp_job_wait(struct LPJob* job)
+{
+	lp_job_wait_i(job);
+	int ok = !job->cancel;
+	lp_heap_alloc(job, 0);
+	return ok;
+}
+
+// indices are claimed from a counter by the caller and up to lp_thread_count - 1 helper tasks,
+// helpers that start after everything is claimed return at once; the caller is slot 0 and helper i slot i
+struct LPParallelFor
+{
+	void (*fn)(void* user, uint32_t ix);
+	void (*fn_slot)(void* user, uint32_t ix, uint32_t slot);
+	void* user;
+	uint32_t count;
+	uint32_t next;
+};
+static void lp_parallel_for_run(void* user, uint32_t slot)
+{
+	struct LPParallelFor* pf = user;
+	for (uint32_t ix; (ix = lp_atomic_add(&pf->next, 1)) < pf->count;)
+		if (pf->fn_slot) pf->fn_slot(pf->user, ix, slot);
+		else pf->fn(pf->user, ix);
+}
+static void lp_parallel_for_i(struct LPParallelFor* pf)
+{
+	struct LPJob job = { 0 };
+	uint32_t tc = LP_MIN(pf->count, lp_thread_count());
+	for (uint32_t i = 1; i < tc; ++i) lp_job_submit_i(&job, lp_parallel_for_run, pf, i);
+	lp_parallel_for_run(pf, 0);
+	lp_job_wait_i(&job);
+}
+void lp_parallel_for(uint32_t count, void (*fn)(void* user, uint32_t ix), void* user)
+{
+	struct LPParallelFor pf = { fn, 0, user, count, 0 };
+	lp_parallel_for_i(&pf);
+}
+void lp_parallel_for_slot(uint32_t count, void (*fn)(void* user, uint32_t ix, uint32_t slot), void* user)
+{
+	struct LPParallelFor pf = { 0, fn, user, count, 0 };
+	lp_parallel_for_i(&pf);
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * TRACE
+ *
+ * Spans go to a buffer owned by the thread that records them: a chain of
+ * fixed blocks only that thread appends to, publishing each event with a
+ * release store of the block count, so recording takes no lock and
+ * lp_trace_save can read every thread while they run. Buffers live until
+ * the process exits, a thread's spans stay readable after it ended.
+ * Without LP_TRACE_ENABLE the hooks are empty macros and this file only
+ * has the stubs of the public functions.
+ *************************************************************************/
+
+#ifdef LP_TRACE_ENABLE
+
+#define LP_TRACE_BLOCK      (4096)  // events per block
+#define LP_TRACE_THREADS    (256)   // threads recording, later ones are dropped
+
+struct LPTraceEvent { const char* name; uint64_t begin, end; };
+struct LPTraceBlock
+{
+	struct LPTraceBlock* next;
+	uint32_t count;
+	struct LPTraceEvent ev[LP_TRACE_BLOCK];
+};
+struct LPTraceThread { struct LPTraceBlock *head, *tail; };
+
+uint32_t lp_trace_on = 0;
+static struct LPTraceThread* lp_trace_thread[LP_TRACE_THREADS];
+static uint32_t lp_trace_thread_count = 0;
+static struct LPTraceThread lp_trace_dropped;
+static LP_TLS struct LPTraceThread* lp_trace_self = 0;
+
+void lp_trace_span(const char* name, uint64_t begin)
+{
+	uint64_t end = lp_time_ns();
+	struct LPTraceThread* t = lp_trace_self;
+	if (!t)
+	{
+		uint32_t ix = lp_atomic_add(&lp_trace_thread_count, 1);
+		t = lp_trace_self = ix < LP_TRACE_THREADS ? lp_heap_alloc(0, sizeof(*t)) : &lp_trace_dropped;
+		if (t == &lp_trace_dropped) return;
+		t->head = t->tail = 0;
+		lp_atomic_store_ptr(&lp_trace_thread[ix], t);
+	}
+	if (t == &lp_trace_dropped) return;
+	struct LPTraceBlock* b = t->tail;
+	if (!b || b->count == LP_TRACE_BLOCK)
+	{
+		struct LPTraceBlock* nb = lp_heap_alloc(0, sizeof(*nb));
+		nb->next = 0, nb->count = 0;
+		if (b) lp_atomic_store_ptr(&b->next, nb);
+		else lp_atomic_store_ptr(&t->head, nb);
+		t->tail = b = nb;
+	}
+	b->ev[b->count] = (struct LPTraceEvent){ name, begin, end };
+	lp_atomic_store(&b->count, b->count + 1);
+}
+
+int lp_trace_enable(int on) { lp_atomic_store(&lp_trace_on, on ? 1u : 0u); return 1; }
+
+// complete events ("ph":"X") in microseconds, one track per recording thread
+int lp_trace_save(const char* fn)
+{
+	struct LPWriter* w = lp_w_open(fn);
+	if (!w) return 0;
+	uint32_t count = lp_atomic_load(&lp_trace_thread_count);
+	const char* sep = "";
+	lp_w_str(w, "{\"traceEvents\":[\n");
+	for (uint32_t i = 0; i < count && i < LP_TRACE_THREADS; ++i)
+	{
+		// a slot is claimed before it's filled, a thread still starting has nothing to show yet
+		struct LPTraceThread* t = lp_atomic_load_ptr(&lp_trace_thread[i]);
+		for (struct LPTraceBlock* b = t ? lp_atomic_load_ptr(&t->head) : 0; b; b = lp_atomic_load_ptr(&b->next))
+		{
+			uint32_t n = lp_atomic_load(&b->count);
+			for (uint32_t k = 0; k < n; ++k)
+			{
+				const struct LPTraceEvent* e = &b->ev[k];
+				char ev[256];
+				snprintf(ev, sizeof(ev), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u}",
+					sep, e->name, i + 1, (unsigned long long)(e->begin / 1000), (unsigned)(e->begin % 1000),
+					(unsigned long long)((e->end - e->begin) / 1000), (unsigned)((e->end - e->begin) % 1000));
+				lp_w_str(w, ev);
+				sep = ",\n";
+			}
+		}
+	}
+	lp_w_str(w, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	return lp_w_close(w);
+}
+
+#else
+
+int lp_trace_enable(int on) { (void)on; return 0; }
+int lp_trace_save(const char* fn) { (void)fn; return 0; }
+
+#endif
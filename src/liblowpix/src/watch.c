@@ -0,0 +1,242 @@
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define LP_WATCH_INOTIFY
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string.h>
+#include "lowpix_i.h"
+
+/*************************************************************************
+ * WATCH
+ *
+ * inotify watches the directory of each file rather than the file, so
+ * tools saving through a temporary file and a rename are seen too.
+ * Files inotify can't follow (other platforms, no watch left) have their
+ * size and time compared every LP_WATCH_SCAN_MS. Either way a change only
+ * arms a deadline pushed back by every further change, the file is
+ * reported once it has been quiet for the debounce delay.
+ *************************************************************************/
+
+#define LP_WATCH_SCAN_MS    (250)
+
+struct LPWatchFile
+{
+	char* path;
+	const char* name;       // in path, after the directory
+	int wd;                 // inotify watch of the directory, -1 when polled
+	uint64_t size, time;
+	uint64_t due;           // lp_time_ns when it reports, 0 if unchanged
+};
+struct LPWatch
+{
+	struct LPWatchFile* file;
+	uint32_t count, cap, polled;
+	int fd;                 // inotify, -1 if unavailable
+	uint64_t debounce, next_scan;
+};
+
+#ifdef __APPLE__
+#define LP_MTIME_NS(st)     ((st).st_mtimespec.tv_nsec)
+#elif !defined(WIN32)
+#define LP_MTIME_NS(st)     ((st).st_mtim.tv_nsec)
+#endif
+
+int lp_file_stamp(const char* fn, uint64_t* size, uint64_t* time)
+{
+#ifdef WIN32
+	WIN32_FILE_ATTRIBUTE_DATA fa;
+	if (!GetFileAttributesExA(fn, GetFileExInfoStandard, &fa)) return 0;
+	*size = (uint64_t)fa.nFileSizeHigh << 32 | fa.nFileSizeLow;
+	*time = ((uint64_t)fa.ftLastWriteTime.dwHighDateTime << 32 | fa.ftLastWriteTime.dwLowDateTime) * 100u; // 100 ns ticks
+#else
+	struct stat st;
+	if (stat(fn, &st) != 0) return 0;
+	*size = (uint64_t)st.st_size, *time = (uint64_t)st.st_mtime * 1000000000u + (uint64_t)LP_MTIME_NS(st);
+#endif
+	return 1;
+}
+static void lp_watch_stat(const char* path, uint64_t* size, uint64_t* time)
+{
+	if (!lp_file_stamp(path, size, time)) *size = ~0ull, *time = 0; // missing counts as a state too
+}
+static void lp_watch_sleep(uint64_t ns)
+{
+#ifdef WIN32
+	Sleep((DWORD)((ns + 999999) / 1000000));
+#else
+	struct timespec ts = { (time_t)(ns / 1000000000u), (long)(ns % 1000000000u) };
+	nanosleep(&ts, 0);
+#endif
+}
+
+struct LPWatch* lp_watch_new(uint32_t debounce_ms)
+{
+	struct LPWatch* w = lp_zalloc(sizeof(*w));
+	w->debounce = (uint64_t)debounce_ms * 1000000u;
+#ifdef LP_WATCH_INOTIFY
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+	w->fd = -1;
+#endif
+	return w;
+}
+void lp_watch_free(struct LPWatch* w)
+{
+	if (!w) return;
+#ifdef LP_WATCH_INOTIFY
+	if (w->fd >= 0) close(w->fd);
+#endif
+	for (uint32_t i = 0; i < w->count; ++i) lp_alloc(w->file[i].path, 0);
+	lp_alloc(w->file, 0); lp_alloc(w, 0);
+}
+
+int lp_watch_add(struct LPWatch* w, const char* fn)
+{
+	for (uint32_t i = 0; i < w->count; ++i) if (strcmp(w->file[i].path, fn) == 0) return 1;
+	if (w->count == w->cap) w->file = lp_alloc(w->file, (w->cap = w->cap ? w->cap * 2 : 16) * sizeof(*w->file));
+	struct LPWatchFile* f = &w->file[w->count++];
+	size_t len = strlen(fn);
+	f->path = memcpy(lp_alloc(0, len + 1), fn, len + 1);
+	f->name = f->path + len;
+	while (f->name > f->path && f->name[-1] != '/' && f->name[-1] != '\\') --f->name;
+	f->wd = -1;
+	f->due = 0;
+	lp_watch_stat(fn, &f->size, &f->time);
+#ifdef LP_WATCH_INOTIFY
+	if (w->fd >= 0 && *f->name)
+	{
+		// adding the same directory again gives back its watch
+		char dir[1024];
+		size_t dir_len = (size_t)(f->name - f->path);
+		if (dir_len == 0) strcpy(dir, ".");
+		else if (dir_len < sizeof(dir)) { memcpy(dir, f->path, dir_len); dir[dir_len] = 0; }
+		else dir[0] = 0;
+		if (dir[0]) f->wd = inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_ATTRIB);
+	}
+#endif
+	if (f->wd < 0) ++w->polled;
+	return 1;
+}
+void lp_watch_remove(struct LPWatch* w, const char* fn)
+{
+	for (uint32_t i = 0; i < w->count; ++i)
+	{
+		struct LPWatchFile* f = &w->file[i];
+		if (strcmp(f->path, fn) != 0) continue;
+		if (f->wd < 0) --w->polled;
+#ifdef LP_WATCH_INOTIFY
+		else
+		{
+			uint32_t users = 0;
+			for (uint32_t j = 0; j < w->count; ++j) users += w->file[j].wd == f->wd;
+			if (users == 1) inotify_rm_watch(w->fd, f->wd);
+		}
+#endif
+		lp_alloc(f->path, 0);
+		*f = w->file[--w->count];
+		return;
+	}
+}
+
+#ifdef LP_WATCH_INOTIFY
+static void lp_watch_read(struct LPWatch* w, uint64_t now)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(w->fd, buf, sizeof(buf))) > 0)
+	{
+		for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len)
+		{
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			for (uint32_t i = 0; i < w->count; ++i)
+			{
+				struct LPWatchFile* f = &w->file[i];
+				if ((ev->mask & IN_Q_OVERFLOW) || (f->wd == ev->wd && ev->len && strcmp(f->name, ev->name) == 0)) f->due = now + w->debounce;
+			}
+		}
+	}
+}
+#endif
+
+uint32_t lp_watch_poll(struct LPWatch* w, uint32_t timeout_ms, const char** changed, uint32_t max)
+{
+	uint64_t now = lp_time_ns(), end = now + (uint64_t)timeout_ms * 1000000u;
+	for (;;)
+	{
+#ifdef LP_WATCH_INOTIFY
+		if (w->fd >= 0) lp_watch_read(w, now);
+#endif
+		if (w->polled && now >= w->next_scan)
+		{
+			for (uint32_t i = 0; i < w->count; ++i)
+			{
+				struct LPWatchFile* f = &w->file[i];
+				uint64_t size, time;
+				if (f->wd >= 0) continue;
+				lp_watch_stat(f->path, &size, &time);
+				if (size != f->size || time != f->time) f->size = size, f->time = time, f->due = now + w->debounce;
+			}
+			w->next_scan = now + LP_WATCH_SCAN_MS * 1000000ull;
+		}
+		uint32_t n = 0;
+		uint64_t until = end;
+		for (uint32_t i = 0; i < w->count; ++i)
+		{
+			struct LPWatchFile* f = &w->file[i];
+			if (!f->due) continue;
+			if (f->due <= now && n < max)
+			{
+				if (f->wd >= 0) lp_watch_stat(f->path, &f->size, &f->time);
+				f->due = 0;
+				changed[n++] = f->path;
+			}
+			else if (f->due < until) until = f->due;
+		}
+		if (n || now >= end) return n;
+		if (w->polled && w->next_scan < until) until = w->next_scan;
+#ifdef LP_WATCH_INOTIFY
+		if (w->fd >= 0)
+		{
+			struct pollfd pfd = { w->fd, POLLIN, 0 };
+			poll(&pfd, 1, (int)((until - now + 999999) / 1000000));
+		}
+		else
+#endif
+		lp_watch_sleep(until - now);
+		now = lp_time_ns();
+	}
+}
+
+uint32_t lp_watch_next(struct LPWatch* w)
+{
+	uint64_t now = lp_time_ns(), until = ~0ull;
+#ifdef LP_WATCH_INOTIFY
+	if (lp_watch_wait(w, 0) > 0) return 0;
+#endif
+	for (uint32_t i = 0; i < w->count; ++i) if (w->file[i].due && w->file[i].due < until) until = w->file[i].due;
+	if (w->polled && w->next_scan < until) until = w->next_scan;
+	if (until == ~0ull) return ~0u;
+	return until <= now ? 0 : (uint32_t)LP_MIN((until - now + 999999) / 1000000, ~0u - 1);
+}
+// only touches the inotify descriptor, which doesn't change until lp_watch_free
+int lp_watch_wait(struct LPWatch* w, uint32_t timeout_ms)
+{
+#ifdef LP_WATCH_INOTIFY
+	if (w->fd >= 0)
+	{
+		struct pollfd pfd = { w->fd, POLLIN, 0 };
+		return poll(&pfd, 1, timeout_ms > INT32_MAX ? -1 : (int)timeout_ms) > 0;
+	}
+#endif
+	(void)timeout_ms;
+	return -1;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include "lowpix.h"
+
+#define LP_WRITER_FILEBUF (256*1024)
+#define LP_WRITER_MEMBUF (4*1024)
+
+struct LPWriter* lp_w_open(const char* fn)
+{
+	FILE* f = fopen(fn, "wb"); if (!f) return 0;
+	struct LPWriter* w = lp_zalloc(sizeof(*w));
+	w->f = f;
+	w->cap = LP_WRITER_FILEBUF;
+	w->buf = lp_alloc(0, w->cap);
+	return w;
+}
+struct LPWriter* lp_w_mem(void)
+{
+	struct LPWriter* w = lp_zalloc(sizeof(*w));
+	w->cap = LP_WRITER_MEMBUF;
+	w->buf = lp_alloc(0, w->cap);
+	return w;
+}
+
+void lp_w_reserve(struct LPWriter* w, size_t sz)
+{
+	if (w->cap - w->pos >= sz) return;
+	if (w->f)
+	{
+		if (w->pos && fwrite(w->buf, 1, w->pos, (FILE*)w->f) != w->pos) w->error = 1;
+		w->pos = 0;
+		if (sz <= w->cap) return;
+	}
+	while (w->cap - w->pos < sz) w->cap *= 2;
+	w->buf = lp_alloc(w->buf, w->cap);
+}
+
+void lp_w_write(struct LPWriter* w, const void* data, size_t sz)
+{
+	lp_w_reserve(w, sz);
+	memcpy(w->buf + w->pos, data, sz);
+	w->pos += sz;
+}
+void lp_w_str(struct LPWriter* w, const char* s) { lp_w_write(w, s, strlen(s)); }
+
+void lp_w_hex(struct LPWriter* w, uint32_t v, int digits)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char tmp[8]; int n = 0;
+	do tmp[n++] = hex[v & 15], v >>= 4; while (v && n < 8);
+	while (n < digits && n < 8) tmp[n++] = '0';
+	lp_w_reserve(w, n);
+	while (n) w->buf[w->pos++] = (uint8_t)tmp[--n];
+}
+
+void lp_w_dec(struct LPWriter* w, int64_t v, int width)
+{
+	char tmp[24]; int n = 0, neg = v < 0;
+	uint64_t u = neg ? 0 - (uint64_t)v : (uint64_t)v;
+	do tmp[n++] = (char)('0' + u % 10), u /= 10; while (u);
+	if (neg) tmp[n++] = '-';
+	while (n < width && n < (int)sizeof(tmp)) tmp[n++] = ' ';
+	lp_w_reserve(w, n);
+	while (n) w->buf[w->pos++] = (uint8_t)tmp[--n];
+}
+
+int lp_w_close(struct LPWriter* w)
+{
+	if (!w) return 0;
+	int ok;
+	if (w->f)
+	{
+		if (w->pos && fwrite(w->buf, 1, w->pos, (FILE*)w->f) != w->pos) w->error = 1;
+		if (fclose((FILE*)w->f) != 0) w->error = 1;
+	}
+	ok = !w->error;
+	lp_alloc(w->buf, 0); lp_alloc(w, 0);
+	return ok;
+}
+void* lp_w_close_mem(struct LPWriter* w, size_t* sz)
+{
+	if (!w || w->f) return 0;
+	void* mem = lp_alloc(w->buf, w->pos ? w->pos : 1);
+	if (sz) *sz = w->pos;
+	lp_alloc(w, 0);
+	return mem;
+}
+
+// make escaping: spaces and # with a backslash, $ doubled
+static void lp_w_dep_path(struct LPWriter* w, const char* s)
+{
+	for (; *s; ++s)
+	{
+		if (*s == ' ' || *s == '#') lp_w_putc(w, '\\');
+		else if (*s == '$') lp_w_putc(w, '$');
+		lp_w_putc(w, *s);
+	}
+}
+int lp_dep_save(const char* fn, const char* const* targets, uint32_t target_count, const char* const* deps, uint32_t dep_count)
+{
+	struct LPWriter* w = lp_w_open(fn); if (!w) return 0;
+	for (uint32_t i = 0; i < target_count; ++i) { if (i) lp_w_putc(w, ' '); lp_w_dep_path(w, targets[i]); }
+	lp_w_putc(w, ':');
+	for (uint32_t i = 0; i < dep_count; ++i) { lp_w_str(w, " \\\n "); lp_w_dep_path(w, deps[i]); }
+	lp_w_putc(w, '\n');
+	// phony targets so make doesn't fail when a dependency is removed
+	for (uint32_t i = 0; i < dep_count; ++i) { lp_w_putc(w, '\n'); lp_w_dep_path(w, deps[i]); lp_w_str(w, ":\n"); }
+	return lp_w_close(w);
+}
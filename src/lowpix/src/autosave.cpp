@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "lowpix.h"
+#include "autosave.h"
+#include "profiler.h"
+
+#define LPE_AUTOSAVE_INTERVAL 2.0 // seconds between flushes of a document being edited
+#define LPE_AUTOSAVE_MAGIC "LPJ1"
+
+// journal: magic, u32 id, u32 name length, name, u32 size, size bytes of snapshot, then deltas of u32 offset, u32 size, bytes
+struct LPEAutosave
+{
+	char path[64], tmp[64];
+	uint32_t id;
+	char* filename;
+	bool dirty, snapshot;   // changes not flushed yet, next flush rewrites the journal
+	size_t lo, hi;          // changed byte range
+	size_t journal;         // delta bytes since the snapshot
+	double last;            // time of the last flush
+	struct LPJob* job;      // write in flight, the fields below belong to it until it's done
+	void* buf;
+	size_t buf_sz;
+	bool buf_snapshot, failed;
+};
+
+static void LPE_W32(struct LPWriter* w, uint32_t v)
+{
+	uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+	lp_w_write(w, b, 4);
+}
+bool LPE_Replace(const char* from, const char* to)
+{
+#ifdef WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+static unsigned long LPE_Pid(void)
+{
+#ifdef WIN32
+	return GetCurrentProcessId();
+#else
+	return (unsigned long)getpid();
+#endif
+}
+// journals are named after the editor writing them, another one running in the same directory still owns
+// its own; a reused pid only delays recovery until that process exits
+static bool LPE_PidAlive(unsigned long pid)
+{
+	if (pid == LPE_Pid()) return false; // left by a previous run that had our pid
+#ifdef WIN32
+	HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+	if (!h) return GetLastError() == ERROR_ACCESS_DENIED;
+	bool alive = WaitForSingleObject(h, 0) == WAIT_TIMEOUT;
+	CloseHandle(h);
+	return alive;
+#else
+	return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+// snapshots go through a temporary file so a crash mid write leaves the previous journal whole
+static void LPE_AutosaveWrite(void* user, uint32_t)
+{
+	LPE_PROF_SCOPE("autosave write");
+	LPEAutosave* a = (LPEAutosave*)user;
+	FILE* f = fopen(a->buf_snapshot ? a->tmp : a->path, a->buf_snapshot ? "wb" : "ab");
+	bool ok = f && fwrite(a->buf, 1, a->buf_sz, f) == a->buf_sz;
+	if (f && fclose(f) != 0) ok = false;
+	if (a->buf_snapshot && !(ok = ok && LPE_Replace(a->tmp, a->path))) remove(a->tmp);
+	a->failed = !ok;
+	lp_alloc(a->buf, 0);
+	a->buf = 0;
+}
+static void LPE_AutosaveStart(LPEAutosave* a, const uint8_t* data, size_t size)
+{
+	struct LPWriter* w = lp_w_mem();
+	a->buf_snapshot = a->snapshot || a->hi > size || a->journal > size + (64 << 10);
+	if (a->buf_snapshot)
+	{
+		size_t name_len = a->filename ? strlen(a->filename) : 0;
+		lp_w_write(w, LPE_AUTOSAVE_MAGIC, 4);
+		LPE_W32(w, a->id);
+		LPE_W32(w, (uint32_t)name_len); lp_w_write(w, a->filename, name_len);
+		LPE_W32(w, (uint32_t)size); lp_w_write(w, data, size);
+		a->journal = 0;
+	}
+	else
+	{
+		LPE_W32(w, (uint32_t)a->lo); LPE_W32(w, (uint32_t)(a->hi - a->lo)); lp_w_write(w, data + a->lo, a->hi - a->lo);
+		a->journal += 8 + a->hi - a->lo;
+	}
+	a->dirty = a->snapshot = false;
+	a->buf = lp_w_close_mem(w, &a->buf_sz);
+	a->job = lp_job_new();
+	lp_job_submit(a->job, LPE_AutosaveWrite, a, 0);
+}
+// reaps a finished write, a failed one makes the next flush a full snapshot
+static bool LPE_AutosaveReady(LPEAutosave* a, bool wait)
+{
+	if (!a->job) return true;
+	if (!wait && !lp_job_done(a->job)) return false;
+	lp_job_wait(a->job);
+	a->job = 0;
+	if (a->failed) a->snapshot = true;
+	return true;
+}
+
+LPEAutosave* LPE_AutosaveNew(uint32_t id, const char* filename)
+{
+	static unsigned counter = 0;
+#ifdef WIN32
+	_mkdir(LPE_AUTOSAVE_DIR);
+#else
+	mkdir(LPE_AUTOSAVE_DIR, 0755);
+#endif
+	LPEAutosave* a = (LPEAutosave*)lp_zalloc(sizeof(LPEAutosave));
+	unsigned long pid = LPE_Pid();
+	unsigned now = (unsigned)time(0);
+	snprintf(a->path, sizeof(a->path), LPE_AUTOSAVE_DIR "/%lu-%08x-%u.lpj", pid, now, counter);
+	snprintf(a->tmp, sizeof(a->tmp), LPE_AUTOSAVE_DIR "/%lu-%08x-%u.tmp", pid, now, counter);
+	++counter;
+	a->id = id;
+	if (filename) a->filename = strcpy((char*)lp_alloc(0, strlen(filename)+1), filename);
+	a->snapshot = true;
+	a->last = -LPE_AUTOSAVE_INTERVAL;
+	return a;
+}
+void LPE_AutosaveTouch(LPEAutosave* a, size_t off, size_t size)
+{
+	if (!a->dirty) a->lo = off, a->hi = off + size;
+	else
+	{
+		if (off < a->lo) a->lo = off;
+		if (off + size > a->hi) a->hi = off + size;
+	}
+	a->dirty = true;
+}
+void LPE_AutosaveTick(LPEAutosave* a, const uint8_t* data, size_t size, double now)
+{
+	if (!LPE_AutosaveReady(a, false) || !(a->dirty || a->snapshot) || now - a->last < LPE_AUTOSAVE_INTERVAL) return;
+	LPE_AutosaveStart(a, data, size);
+	a->last = now;
+}
+void LPE_AutosaveFlush(LPEAutosave* a, const uint8_t* data, size_t size)
+{
+	LPE_AutosaveReady(a, true);
+	if (a->dirty || a->snapshot) LPE_AutosaveStart(a, data, size);
+	LPE_AutosaveReady(a, true);
+}
+void LPE_AutosaveFree(LPEAutosave* a, bool keep)
+{
+	if (!a) return;
+	LPE_AutosaveReady(a, true);
+	if (!keep) remove(a->path);
+	lp_alloc(a->filename, 0); lp_alloc(a, 0);
+}
+
+// a torn last delta (crash mid append) is ignored, everything before it is recovered
+static bool LPE_AutosaveReplay(const char* path, void (*fn)(void* user, uint32_t id, const char* filename, const uint8_t* data, size_t size), void* user)
+{
+	struct LPFileMap* fm = lp_mmap(path);
+	if (!fm) return false;
+	uint8_t *p = (uint8_t*)fm->mem, *end = p + fm->size;
+	bool ok = fm->size >= 16 && memcmp(p, LPE_AUTOSAVE_MAGIC, 4) == 0;
+	size_t name_len = ok ? lp_read_u32_le(p + 8) : 0;
+	ok = ok && name_len <= (size_t)(end - p) - 16;
+	size_t size = ok ? lp_read_u32_le(p + 12 + name_len) : 0;
+	ok = ok && size <= (size_t)(end - p) - 16 - name_len;
+	if (ok)
+	{
+		char* filename = name_len ? (char*)memcpy(lp_zalloc(name_len + 1), p + 12, name_len) : 0;
+		uint8_t* data = (uint8_t*)memcpy(lp_alloc(0, size ? size : 1), p + 16 + name_len, size);
+		uint32_t id = lp_read_u32_le(p + 4);
+		for (p += 16 + name_len + size; end - p >= 8;)
+		{
+			size_t off = lp_read_u32_le(p), n = lp_read_u32_le(p + 4);
+			if (n > (size_t)(end - p) - 8 || off > size || n > size - off) break;
+			memcpy(data + off, p + 8, n);
+			p += 8 + n;
+		}
+		fn(user, id, filename, data, size);
+		lp_alloc(filename, 0); lp_alloc(data, 0);
+	}
+	lp_munmap(fm);
+	return ok;
+}
+int LPE_AutosaveRecover(void (*fn)(void* user, uint32_t id, const char* filename, const uint8_t* data, size_t size), void* user)
+{
+	int count = 0;
+	char path[300];
+#ifdef WIN32
+	WIN32_FIND_DATAA fd;
+	HANDLE h = FindFirstFileA(LPE_AUTOSAVE_DIR "\\*", &fd);
+	if (h == INVALID_HANDLE_VALUE) return 0;
+	do
+	{
+		const char* name = fd.cFileName;
+#else
+	DIR* dir = opendir(LPE_AUTOSAVE_DIR);
+	if (!dir) return 0;
+	while (struct dirent* de = readdir(dir))
+	{
+		const char* name = de->d_name;
+#endif
+		size_t len = strlen(name);
+		unsigned long pid;
+		unsigned stamp, n;
+		if (len < 4 || (strcmp(name + len - 4, ".lpj") && strcmp(name + len - 4, ".tmp"))) continue;
+		if (sscanf(name, "%lu-%x-%u.", &pid, &stamp, &n) == 3 && LPE_PidAlive(pid)) continue;
+		snprintf(path, sizeof(path), LPE_AUTOSAVE_DIR "/%s", name);
+		if (strcmp(name + len - 4, ".lpj") == 0 && LPE_AutosaveReplay(path, fn, user)) ++count;
+		remove(path);
+#ifdef WIN32
+	} while (FindNextFileA(h, &fd));
+	FindClose(h);
+#else
+	}
+	closedir(dir);
+#endif
+	return count;
+}
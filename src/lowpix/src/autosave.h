@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Autosave journal of a document: a snapshot of its bytes followed by the ranges changed since.
+// Ranges are copied out on the main thread when a flush is due, the file writes run as pool tasks
+// (lp_job_submit never runs them in the caller, only LPE_AutosaveFlush and LPE_AutosaveFree wait),
+// one at a time per document so records stay in order. The journal is rewritten as a fresh snapshot
+// once its deltas outgrow the document.
+
+#define LPE_AUTOSAVE_DIR "lowpix-autosave"
+
+struct LPEAutosave;
+
+// id and filename identify the document on recovery, filename is its own file (0 for unnamed documents)
+extern LPEAutosave* LPE_AutosaveNew(uint32_t id, const char* filename);
+extern void LPE_AutosaveTouch(LPEAutosave* a, size_t off, size_t size); // bytes changed since the last flush
+// flushes changes when the last flush is older than the interval, never waits for the previous write
+extern void LPE_AutosaveTick(LPEAutosave* a, const uint8_t* data, size_t size, double now);
+extern void LPE_AutosaveFlush(LPEAutosave* a, const uint8_t* data, size_t size); // waits until everything is written
+// waits for the pending write, the journal is deleted unless kept for recovery
+extern void LPE_AutosaveFree(LPEAutosave* a, bool keep);
+
+// rename over an existing file, for writes through a temporary file
+extern bool LPE_Replace(const char* from, const char* to);
+
+// calls fn for each journal left in LPE_AUTOSAVE_DIR by a previous run, then deletes it, returns the count;
+// journals of another editor still running there are left alone
+extern int LPE_AutosaveRecover(void (*fn)(void* user, uint32_t id, const char* filename, const uint8_t* data, size_t size), void* user);
@@ -1,17 +1,31 @@
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <thread>
 #include "lowpix.h"
 #include "imgui.h"
 #include "tinyfiledialogs.h"
+#include "history.h"
+#include "autosave.h"
+#include "profiler.h"
 #define DR_PATH_IMPLEMENTATION
 #include "dr_path.h"
 
+struct LPELoad;
 struct LPEPalNode
 {
 	LPEPalNode *next, *prev;
-	struct LPPalette* pal;
+	struct LPPalette* pal;  // 0 while load is pending
+	LPELoad* load;          // first load, or a reload from disk while pal stays shown
+	LPEAutosave* autosave;  // journal of unsaved changes
 	char* filename;
 	bool need_save;
 	uint32_t edit_ix;
 	uint32_t selectend_ix;
+	uint32_t id;            // stable across sessions, names the dock
+	uint32_t file_size;     // of filename when it was loaded or saved, with its time in ns
+	uint64_t file_time;
 };
 static struct LPE
 {
@@ -20,7 +34,40 @@ static struct LPE
 	int pal_c;
 	LPEPalNode* pal_l;
 	LPEPalNode* rem_paln_pending;
+	struct LPJob* load_job;
+	int redraw;             // frames still to draw before going idle
+	LPEHistory* history;
+	bool show_profiler;
+	struct LPWatch* watch;  // files of the open documents
+	uint32_t last_id;
 } lpe = { 0 };
+enum { LPE_REDRAW_FRAMES = 3 };
+#define LPE_HISTORY_BUDGET (64 << 20)
+#define LPE_WATCH_DEBOUNCE 200 // ms a file must stay unchanged before it's reloaded
+
+// files are read and parsed by pool tasks, finished loads are pushed on a lock-free stack drained each tick,
+// the task never touches the node so closing a placeholder only has to drop the link
+struct LPELoad
+{
+	LPELoad* next;
+	LPEPalNode* node;       // main thread only, 0 once the placeholder was closed
+	char* filename;
+	std::atomic<size_t> size, read;
+	std::atomic<bool> cancel;
+	struct LPPalette* pal;  // result, 0 on failure
+};
+static std::atomic<LPELoad*> lpe_loaded(nullptr);
+extern void LPE_Wake(void); // any thread, makes an idle main loop draw a frame
+
+// inotify events don't wake the main loop, this thread does and leaves them for LPE_PollWatch to read,
+// it naps after a wake so it doesn't spin until that tick runs
+static std::thread lpe_watch_thread;
+static std::atomic<bool> lpe_watch_stop(false);
+static void LPE_WatchWake(struct LPWatch* w)
+{
+	for (int r; !lpe_watch_stop.load(std::memory_order_relaxed) && (r = lp_watch_wait(w, 500)) >= 0;)
+		if (r) { LPE_Wake(); std::this_thread::sleep_for(std::chrono::milliseconds(20)); }
+}
 
 enum LPEDialogResult
 {
@@ -32,25 +79,300 @@ enum LPEDialogResult
 
 static LPEPalNode* LPE_AddPalette(struct LPPalette* pal)
 {
-	LPEPalNode* n = (LPEPalNode*)lp_zalloc(sizeof(*lpe.pal_l)); n->pal = pal;
+	LPEPalNode* n = (LPEPalNode*)lp_zalloc(sizeof(*lpe.pal_l)); n->pal = pal; n->id = ++lpe.last_id;
 	if (lpe.pal_l) lpe.pal_l->prev = n;
 	n->next = lpe.pal_l; lpe.pal_l = n;
 	++lpe.pal_c; return n;
 }
+static void LPE_Watch(LPEPalNode* n)
+{
+	if (!n->filename) return;
+	if (!lpe.watch) { lpe.watch = lp_watch_new(LPE_WATCH_DEBOUNCE); lpe_watch_thread = std::thread(LPE_WatchWake, lpe.watch); }
+	lp_watch_add(lpe.watch, n->filename);
+}
+// other documents may still show the same file
+static void LPE_Unwatch(LPEPalNode* n)
+{
+	if (!n->filename || !lpe.watch) return;
+	for (LPEPalNode* o = lpe.pal_l; o; o = o->next) if (o != n && o->filename && strcmp(o->filename, n->filename) == 0) return;
+	lp_watch_remove(lpe.watch, n->filename);
+}
 static void LPE_RemPalette(LPEPalNode* n)
 {
+	LPE_Unwatch(n);
 	if (n->prev) n->prev->next = n->next; else lpe.pal_l = n->next;
 	if (n->next) n->next->prev = n->prev;
-	lp_alloc(n->pal, 0); lp_alloc(n, 0);
+	if (n->load) { n->load->node = 0; n->load->cancel = true; }
+	if (lpe.history) LPE_HistoryForget(lpe.history, n);
+	LPE_AutosaveFree(n->autosave, false);
+	lp_alloc(n->pal, 0); lp_alloc(n->filename, 0); lp_alloc(n, 0);
 	--lpe.pal_c;
 }
-static void LPE_OpenPalette(const char* fn)
+
+static void LPE_LoadTask(void* user, uint32_t)
+{
+	LPE_PROF_SCOPE("load");
+	static const size_t CHUNK = 256 << 10; // progress granularity
+	LPELoad* l = (LPELoad*)user;
+	if (FILE* f = fopen(l->filename, "rb"))
+	{
+		fseek(f, 0, SEEK_END); long sz = ftell(f); fseek(f, 0, SEEK_SET);
+		uint8_t* data = sz > 0 ? (uint8_t*)lp_alloc(0, (size_t)sz) : 0; // directories report nonsense sizes
+		if (data)
+		{
+			l->size = (size_t)sz;
+			size_t rd = 0;
+			for (size_t n = 1; rd < (size_t)sz && n && !l->cancel; l->read = rd += n)
+				n = fread(data + rd, 1, (size_t)sz - rd < CHUNK ? (size_t)sz - rd : CHUNK, f);
+			if (rd == (size_t)sz && !l->cancel) { LPE_PROF_SCOPE("lp_pal_load"); l->pal = lp_pal_load(l->filename, data, rd); }
+			lp_alloc(data, 0);
+		}
+		fclose(f);
+	}
+	l->next = lpe_loaded.load(std::memory_order_relaxed);
+	while (!lpe_loaded.compare_exchange_weak(l->next, l, std::memory_order_release, std::memory_order_relaxed));
+	LPE_Wake();
+}
+static void LPE_Load(LPEPalNode* n)
+{
+	LPELoad* l = new LPELoad();
+	l->node = n;
+	l->filename = strcpy((char*)lp_alloc(0, strlen(n->filename)+1), n->filename);
+	n->load = l;
+	if (!lpe.load_job) lpe.load_job = lp_job_new();
+	lp_job_submit(lpe.load_job, LPE_LoadTask, l, 0);
+}
+static LPEPalNode* LPE_OpenPalette(const char* fn)
+{
+	LPEPalNode* n = LPE_AddPalette(0);
+	n->filename = strcpy((char*)lp_alloc(0, strlen(fn)+1), fn);
+	LPE_Load(n);
+	return n;
+}
+static bool LPE_FileStamp(const char* fn, uint32_t* size, uint64_t* time)
+{
+	uint64_t size64;
+	if (!fn || !lp_file_stamp(fn, &size64, time)) return false;
+	*size = (uint32_t)size64;
+	return true;
+}
+// failed loads just drop their placeholder, like a failed synchronous open did, a failed reload keeps
+// what was shown and so does one that finished after the document was edited
+static void LPE_DrainLoads(void)
+{
+	for (LPELoad *l = lpe_loaded.exchange(nullptr, std::memory_order_acquire), *next; l; l = next)
+	{
+		next = l->next;
+		lpe.redraw = LPE_REDRAW_FRAMES;
+		LPEPalNode* n = l->node;
+		if (n) n->load = 0;
+		if (n && l->pal && !n->need_save)
+		{
+			if (n->pal && lpe.history) LPE_HistoryForget(lpe.history, n);
+			lp_alloc(n->pal, 0);
+			n->pal = l->pal;
+			LPE_FileStamp(n->filename, &n->file_size, &n->file_time);
+			LPE_Watch(n);
+		}
+		else
+		{
+			if (n && !n->pal) LPE_RemPalette(n);
+			lp_alloc(l->pal, 0);
+		}
+		lp_alloc(l->filename, 0);
+		delete l;
+	}
+}
+
+// documents showing a changed file are loaded again unless they have unsaved edits, their own saves
+// are told apart by the stamp taken after writing
+static void LPE_PollWatch(void)
+{
+	LPE_PROF_SCOPE("lp_watch_poll");
+	const char* changed[16];
+	uint32_t count = lpe.watch ? lp_watch_poll(lpe.watch, 0, changed, 16) : 0;
+	for (uint32_t i = 0; i < count; ++i)
+		for (LPEPalNode* n = lpe.pal_l; n; n = n->next)
+		{
+			uint32_t size = 0;
+			uint64_t time = 0;
+			if (!n->pal || n->load || n->need_save || !n->filename || strcmp(n->filename, changed[i]) != 0) continue;
+			if (LPE_FileStamp(n->filename, &size, &time) && (size != n->file_size || time != n->file_time)) LPE_Load(n);
+		}
+}
+
+// history documents are palette nodes, edits are recorded on their color bytes
+static uint8_t* LPE_PalData(void* doc, size_t* size)
+{
+	struct LPPalette* pal = ((LPEPalNode*)doc)->pal;
+	if (!pal) return 0;
+	*size = pal->col_count * sizeof(*pal->col);
+	return (uint8_t*)pal->col;
+}
+static LPEHistory* LPE_History(void)
+{
+	if (!lpe.history) lpe.history = LPE_HistoryNew(LPE_PalData, LPE_HISTORY_BUDGET);
+	return lpe.history;
+}
+static void LPE_Changed(LPEPalNode* n, size_t off, size_t size)
+{
+	n->need_save = true;
+	if (n->autosave) LPE_AutosaveTouch(n->autosave, off, size);
+}
+static void LPE_Undo(void)
+{
+	LPE_PROF_SCOPE("undo");
+	size_t off, size;
+	if (LPEPalNode* n = (LPEPalNode*)LPE_HistoryUndo(LPE_History(), &off, &size)) LPE_Changed(n, off, size);
+}
+static void LPE_Redo(void)
+{
+	LPE_PROF_SCOPE("redo");
+	size_t off, size;
+	if (LPEPalNode* n = (LPEPalNode*)LPE_HistoryRedo(LPE_History(), &off, &size)) LPE_Changed(n, off, size);
+}
+
+// unsaved palettes get a journal, saving or closing them drops it, recovered ones come back unsaved
+static void LPE_Autosave(LPEPalNode* n)
+{
+	LPE_PROF_SCOPE("autosave");
+	size_t size;
+	uint8_t* data = LPE_PalData(n, &size);
+	if (!data || !n->need_save) { LPE_AutosaveFree(n->autosave, false); n->autosave = 0; return; }
+	if (!n->autosave) n->autosave = LPE_AutosaveNew(n->id, n->filename);
+	LPE_AutosaveTick(n->autosave, data, size, ImGui::GetTime());
+}
+static struct LPPalette* LPE_PalFromData(const void* data, uint32_t cc)
+{
+	struct LPPalette* pal = (struct LPPalette*)lp_alloc(0, offsetof(struct LPPalette, col) + cc * sizeof(uint32_t));
+	pal->col_count = cc;
+	memcpy(pal->col, data, cc * sizeof(*pal->col));
+	return pal;
+}
+// a journal newer than the session replaces the document the session restored
+static void LPE_Recovered(void*, uint32_t id, const char* filename, const uint8_t* data, size_t size)
+{
+	uint32_t cc = (uint32_t)(size / sizeof(uint32_t));
+	if (cc == 0) return;
+	LPEPalNode* n = lpe.pal_l;
+	for (; n && n->id != id; n = n->next);
+	if (n)
+	{
+		if (n->load) { n->load->node = 0; n->load->cancel = true; n->load = 0; }
+		if (lpe.history) LPE_HistoryForget(lpe.history, n);
+		lp_alloc(n->pal, 0);
+		n->pal = LPE_PalFromData(data, cc);
+	}
+	else
+	{
+		n = LPE_AddPalette(LPE_PalFromData(data, cc));
+		if (filename) n->filename = strcpy((char*)lp_alloc(0, strlen(filename)+1), filename);
+		LPE_Watch(n);
+	}
+	n->need_save = true;
+}
+
+// session: magic, u32 last id, u32 count, then per document from the oldest: u32 id, u32 need_save, u32 edit_ix,
+// u32 selectend_ix, u32 name length, name, u32 file size, u32 file time, u32 color count, colors.
+// Documents whose file has the same size and time as when it was read come back from the snapshot
+// without parsing, unsaved ones always do, the others are loaded again
+#define LPE_SESSION "lowpix.session"
+#define LPE_SESSION_TMP LPE_SESSION ".tmp" // written then renamed, a crash mid write keeps the previous session
+#define LPE_SESSION_MAGIC "LPS2"
+static void LPE_W32(struct LPWriter* w, uint32_t v)
+{
+	uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+	lp_w_write(w, b, 4);
+}
+static bool LPE_SaveSession(void)
+{
+	LPE_PROF_SCOPE("session save");
+	struct LPWriter* w = lp_w_open(LPE_SESSION_TMP);
+	if (!w) return false;
+	LPEPalNode* last = lpe.pal_l;
+	for (; last && last->next; last = last->next);
+	lp_w_write(w, LPE_SESSION_MAGIC, 4);
+	LPE_W32(w, lpe.last_id); LPE_W32(w, (uint32_t)lpe.pal_c);
+	for (LPEPalNode* n = last; n; n = n->prev)
+	{
+		uint32_t name_len = n->filename ? (uint32_t)strlen(n->filename) : 0, cc = n->pal ? n->pal->col_count : 0;
+		LPE_W32(w, n->id); LPE_W32(w, n->need_save); LPE_W32(w, n->edit_ix); LPE_W32(w, n->selectend_ix);
+		LPE_W32(w, name_len); lp_w_write(w, n->filename, name_len);
+		LPE_W32(w, n->file_size); LPE_W32(w, (uint32_t)n->file_time); LPE_W32(w, (uint32_t)(n->file_time >> 32));
+		LPE_W32(w, cc); if (cc) lp_w_write(w, n->pal->col, cc * sizeof(*n->pal->col));
+	}
+	if (lp_w_close(w) && LPE_Replace(LPE_SESSION_TMP, LPE_SESSION)) return true;
+	remove(LPE_SESSION_TMP);
+	return false;
+}
+static void LPE_LoadSession(void)
 {
-	if (struct LPPalette* pal = lp_pal_load(fn, 0, 0))
+	LPE_PROF_SCOPE("session load");
+	struct LPFileMap* fm = lp_mmap(LPE_SESSION);
+	if (!fm) return;
+	uint8_t *p = (uint8_t*)fm->mem, *end = p + fm->size;
+	if (fm->size >= 12 && memcmp(p, LPE_SESSION_MAGIC, 4) == 0)
 	{
-		LPEPalNode* n = LPE_AddPalette(pal);
-		n->filename = strdup(fn);
+		uint32_t last_id = lp_read_u32_le(p + 4), count = lp_read_u32_le(p + 8);
+		for (p += 12; count-- > 0 && end - p >= 20;)
+		{
+			uint32_t id = lp_read_u32_le(p), need_save = lp_read_u32_le(p + 4), edit_ix = lp_read_u32_le(p + 8), selectend_ix = lp_read_u32_le(p + 12);
+			size_t name_len = lp_read_u32_le(p + 16);
+			if ((size_t)(end - p) < 36 || name_len > (size_t)(end - p) - 36) break;
+			char* fn = name_len ? (char*)memcpy(lp_zalloc(name_len + 1), p + 20, name_len) : 0;
+			p += 20 + name_len;
+			uint32_t file_size = lp_read_u32_le(p), cc = lp_read_u32_le(p + 12), size;
+			uint64_t file_time = lp_read_u32_le(p + 4) | (uint64_t)lp_read_u32_le(p + 8) << 32, time;
+			p += 16;
+			if (cc > (size_t)(end - p) / sizeof(uint32_t)) { lp_alloc(fn, 0); break; }
+			const uint8_t* col = p;
+			p += cc * sizeof(uint32_t);
+			LPEPalNode* n = 0;
+			if (cc && (need_save || !fn || (LPE_FileStamp(fn, &size, &time) && size == file_size && time == file_time)))
+			{
+				n = LPE_AddPalette(LPE_PalFromData(col, cc));
+				n->filename = fn, n->file_size = file_size, n->file_time = file_time;
+				LPE_Watch(n);
+			}
+			else if (fn) { n = LPE_OpenPalette(fn); lp_alloc(fn, 0); }
+			if (!n) continue;
+			n->id = id, n->need_save = need_save != 0, n->edit_ix = edit_ix, n->selectend_ix = selectend_ix;
+		}
+		lpe.last_id = last_id; // the ids LPE_AddPalette gave were all replaced
 	}
+	lp_munmap(fm);
+}
+
+void LPE_Shutdown(void)
+{
+	// loads still finishing can watch their file, so they're settled before the watch goes
+	if (lpe.load_job)
+	{
+		for (LPEPalNode* n = lpe.pal_l; n; n = n->next) if (n->load) n->load->cancel = true;
+		lp_job_wait(lpe.load_job);
+		lpe.load_job = 0;
+		LPE_DrainLoads();
+	}
+	// unsaved work is in the session, or stays in the journals if it couldn't be written
+	bool session = LPE_SaveSession();
+	for (LPEPalNode* n = lpe.pal_l; n; n = n->next)
+	{
+		size_t size;
+		uint8_t* data = LPE_PalData(n, &size);
+		bool keep = !session && data && n->need_save;
+		if (keep)
+		{
+			if (!n->autosave) n->autosave = LPE_AutosaveNew(n->id, n->filename);
+			LPE_AutosaveFlush(n->autosave, data, size);
+		}
+		LPE_AutosaveFree(n->autosave, keep);
+		n->autosave = 0;
+	}
+	LPE_HistoryFree(lpe.history);
+	lpe.history = 0;
+	if (lpe_watch_thread.joinable()) { lpe_watch_stop = true; lpe_watch_thread.join(); }
+	lp_watch_free(lpe.watch);
+	lpe.watch = 0;
 }
 static void LPE_Dialog_OpenPalette(void)
 {	
@@ -63,17 +385,22 @@ static void LPE_Dialog_OpenPalette(void)
 
 static bool LPE_SavePalette(LPPalette* pal, const char* fn)
 {
+	LPE_PROF_SCOPE("lp_pal_save");
 	return lp_pal_save(pal, fn, LP_PALETTEFORMAT_EXT) != 0;
 }
 static void LPE_Dialog_SavePalette(LPEPalNode* n)
 {
-	static const char* formats[] = { "*.act", "*.bin", "*.c", "*.gpl", "*.s" };
-	if (const char* fn = tinyfd_saveFileDialog("Save Palette", "", sizeof(formats) / sizeof(*formats), formats, "Palette Files (*.act, *.bin, *.c, *.gpl, *.s)"))
+	static const char* formats[] = { "*.act", "*.bin", "*.c", "*.gpl", "*.o", "*.s" };
+	if (const char* fn = tinyfd_saveFileDialog("Save Palette", "", sizeof(formats) / sizeof(*formats), formats, "Palette Files (*.act, *.bin, *.c, *.gpl, *.o, *.s)"))
 	{
 		if (LPE_SavePalette(n->pal, fn))
 		{
 			n->need_save = false;
+			LPE_Unwatch(n);
+			lp_alloc(n->filename, 0);
 			n->filename = strcpy((char*)lp_alloc(0, strlen(fn)+1), fn);
+			LPE_FileStamp(n->filename, &n->file_size, &n->file_time);
+			LPE_Watch(n);
 		}
 	}
 }
@@ -95,9 +422,82 @@ static LPEDialogResult LPE_Dialog_NeedSave(const char* name, const char* content
 	return r;
 }
 
-void LPE_Tick(char* droppedFiles)
+// one item for the whole grid, only visible rows are drawn and the entry under the mouse is found by math,
+// so frame time doesn't depend on the palette size
+static void LPE_SwatchGrid(LPEPalNode* paln)
+{
+	LPE_PROF_SCOPE("swatches");
+	enum { COLS = 16 };
+	ImGuiIO& io = ImGui::GetIO();
+	ImGuiStyle& style = ImGui::GetStyle();
+	struct LPPalette* pal = paln->pal;
+	uint32_t* c = pal->col;
+	const float sq = ImGui::GetFontSize() + style.FramePadding.y*2; // same as ColorButton
+	const ImVec2 step(sq + style.ItemSpacing.x, sq + style.ItemSpacing.y);
+	const int rows = (int)((pal->col_count + COLS-1) / COLS);
+	int row0, row1;
+	ImGui::BeginGroup();
+	ImGui::CalcListClipping(rows, step.y, &row0, &row1);
+	const ImVec2 org = ImGui::GetCursorScreenPos();
+	bool pressed = ImGui::InvisibleButton("##swatches", ImVec2(COLS*step.x - style.ItemSpacing.x, rows ? rows*step.y - style.ItemSpacing.y : 1));
+
+	ImDrawList* dl = ImGui::GetWindowDrawList();
+	ImU32 border = ImGui::GetColorU32(ImGuiCol_Border), select = 0xFF00FF00;
+	for (uint32_t i = row0 * COLS; i < pal->col_count && i < (uint32_t)row1 * COLS; ++i)
+	{
+		ImVec2 a(org.x + (i%COLS)*step.x, org.y + (i/COLS)*step.y), b(a.x + sq, a.y + sq);
+		dl->AddRectFilled(a, b, c[i] | 0xFF<<24, style.FrameRounding);
+		dl->AddRect(a, b, i >= paln->edit_ix && i <= paln->selectend_ix ? select : border, style.FrameRounding);
+	}
+
+	uint32_t i = ~0u;
+	ImVec2 m(io.MousePos.x - org.x, io.MousePos.y - org.y);
+	if (ImGui::IsItemHovered() && m.x >= 0 && m.y >= 0 && fmodf(m.x, step.x) < sq && fmodf(m.y, step.y) < sq && (int)(m.x / step.x) < COLS)
+		i = (uint32_t)(m.y / step.y) * COLS + (uint32_t)(m.x / step.x);
+	if (i < pal->col_count)
+	{
+		uint32_t col = c[i];
+		ImVec4 colf = ImColor(col | 0xFF<<24).Value;
+		ImGui::SetTooltip("Entry %d [0x%X]\n#%02X%02X%02X (%.2f,%.2f,%.2f)", i, i, col&0xFF, (col>>8)&0xFF, (col>>16)&0xFF, colf.x, colf.y, colf.z);
+		if (pressed)
+		{
+			if (!io.KeyShift) paln->edit_ix = paln->selectend_ix = i;
+			else
+			{
+				paln->selectend_ix = i;
+				if (paln->selectend_ix < paln->edit_ix) { uint32_t t = paln->selectend_ix; paln->selectend_ix = paln->edit_ix; paln->edit_ix = t; }
+			}
+		}
+	}
+	ImGui::EndGroup();
+}
+
+// ImGui needs a couple of frames to settle after input (hover, popups opening), so any activity keeps
+// drawing for a few frames, loads in progress animate their progress bar
+static bool LPE_Active(void)
+{
+	ImGuiIO& io = ImGui::GetIO();
+	bool active = io.MouseDelta.x != 0 || io.MouseDelta.y != 0 || io.MouseWheel != 0 || io.InputCharacters[0] || io.WantTextInput;
+	for (int i = 0; !active && i < 5; ++i) active = io.MouseDown[i];
+	for (int i = 0; !active && i < 512; ++i) active = io.KeysDown[i];
+	for (LPEPalNode* n = lpe.pal_l; !active && n; n = n->next) active = n->load && !n->pal;
+	if (active) lpe.redraw = LPE_REDRAW_FRAMES;
+	else if (lpe.redraw > 0) --lpe.redraw;
+	return lpe.redraw > 0;
+}
+
+// how long an idle main loop may block, at most max seconds: watched files report when their quiet period ends
+double LPE_IdleTimeout(double max)
+{
+	uint32_t ms = lpe.watch ? lp_watch_next(lpe.watch) : ~0u;
+	return ms < max * 1000 ? ms / 1000.0 : max;
+}
+
+// returns false when nothing changes until the next input event, LPE_Wake or LPE_IdleTimeout
+bool LPE_Tick(char* droppedFiles)
 {
 	//ImGui::ShowTestWindow(0);return;
+	LPE_PROF_SCOPE("LPE_Tick");
 
 	ImGuiIO& io = ImGui::GetIO();
 	ImGuiStyle& style = ImGui::GetStyle();
@@ -105,7 +505,11 @@ void LPE_Tick(char* droppedFiles)
 
 	bool show_options = false;
 
+	static bool recovered = false;
+	if (!recovered) { LPE_LoadSession(); LPE_AutosaveRecover(LPE_Recovered, 0); recovered = true; }
 	for (; *droppedFiles; droppedFiles += strlen(droppedFiles)+1) LPE_OpenPalette(droppedFiles);
+	LPE_DrainLoads();
+	LPE_PollWatch();
 
 	style.Colors[ImGuiCol_MenuBarBg] = lpe.need_save ? ImVec4(142.0f / 255.0f, 218.0f / 255.0f, 140.0f / 255.0f, styledef.Colors[ImGuiCol_MenuBarBg].w) : styledef.Colors[ImGuiCol_MenuBarBg];
 	if (ImGui::BeginMainMenuBar())
@@ -124,14 +528,19 @@ void LPE_Tick(char* droppedFiles)
 		}
 		if (ImGui::BeginMenu("EDIT"))
 		{
-			if (ImGui::MenuItem("Undo", "CTRL+Z")) {}
-			if (ImGui::MenuItem("Redo", "CTRL+Y", false, false)) {}  // Disabled item
+			if (ImGui::MenuItem("Undo", "CTRL+Z", false, LPE_HistoryCanUndo(LPE_History()))) LPE_Undo();
+			if (ImGui::MenuItem("Redo", "CTRL+Y", false, LPE_HistoryCanRedo(LPE_History()))) LPE_Redo();
 			ImGui::Separator();
 			if (ImGui::MenuItem("Cut", "CTRL+X")) {}
 			if (ImGui::MenuItem("Copy", "CTRL+C")) {}
 			if (ImGui::MenuItem("Paste", "CTRL+V")) {}
 			ImGui::EndMenu();
 		}
+		if (ImGui::BeginMenu("VIEW"))
+		{
+			ImGui::MenuItem("Profiler", nullptr, &lpe.show_profiler);
+			ImGui::EndMenu();
+		}
 
 		ImGui::EndMainMenuBar();
 	}
@@ -151,17 +560,36 @@ void LPE_Tick(char* droppedFiles)
 		static const ImVec2 btn_sz = { 80, 0 };
 		struct LPPalette* pal = paln->pal;
 		char dock_name[256];
-		snprintf(dock_name, sizeof(dock_name), "%s%s##%p", paln->filename ? drpath_file_name(paln->filename) : "<noname>", paln->need_save ? " *" : "", pal);
+		snprintf(dock_name, sizeof(dock_name), "%s%s###lpe%u", paln->filename ? drpath_file_name(paln->filename) : "<noname>", paln->need_save ? " *" : "", paln->id);
 		dock_name[sizeof(dock_name)-1] = 0;
-		if (ImGui::BeginDock(dock_name, false))
+		if (!pal)
+		{
+			if (ImGui::BeginDock(dock_name))
+			{
+				ImGui::PushID(paln);
+				if (ImGui::Button("CANCEL", btn_sz)) rem_paln = paln;
+				size_t size = paln->load->size, read = paln->load->read;
+				char overlay[64];
+				snprintf(overlay, sizeof(overlay), "loading %u / %u KB", (unsigned)(read >> 10), (unsigned)(size >> 10));
+				ImGui::ProgressBar(size ? (float)read / size : 0.0f, ImVec2(-1, 0), overlay);
+				ImGui::PopID();
+			}
+			ImGui::EndDock();
+			continue;
+		}
+		if (ImGui::BeginDock(dock_name))
 		{
-			ImGui::PushID(pal);
+			ImGui::PushID(paln);
 
 			if (ImGui::Button("CLOSE", btn_sz)) rem_paln = paln;
 			if (paln->filename)
 			{
 				ImGui::SameLine();
-				if (ImGui::Button("SAVE", btn_sz)) { if (LPE_SavePalette(pal, paln->filename)) paln->need_save = false; }
+				if (ImGui::Button("SAVE", btn_sz) && LPE_SavePalette(pal, paln->filename))
+				{
+					paln->need_save = false;
+					LPE_FileStamp(paln->filename, &paln->file_size, &paln->file_time);
+				}
 			}
 			ImGui::SameLine();
 			if (ImGui::Button("SAVE AS", btn_sz)) { LPE_Dialog_SavePalette(paln); }
@@ -178,38 +606,32 @@ void LPE_Tick(char* droppedFiles)
 				uint32_t col = c[paln->edit_ix];
 				ImVec4 colf = ImColor(col | 0xFF<<24).Value;
 				ImGui::BeginGroup();
-				if (ImGui::ColorPicker(&colf.x, false)) { c[paln->edit_ix] = (ImU32)ImColor(colf); paln->need_save = true; }
-				ImGui::EndGroup();
-				ImGui::SameLine();
-			}
-			ImGui::BeginGroup();
-			for (uint32_t i = 0; i < pal->col_count; ++i)
-			{
-				uint32_t col = c[i];
-				ImVec4 colf = ImColor(col | 0xFF<<24).Value;
-				ImGui::PushID(i);
-				ImGui::PushStyleColor(ImGuiCol_Border, i >= paln->edit_ix && i <= paln->selectend_ix ? ImColor(0xFF00FF00).Value : styledef.Colors[ImGuiCol_Border]);
-				if (ImGui::ColorButton(colf))
+				if (ImGui::ColorPicker(&colf.x, false))
 				{
-					if (!io.KeyShift) paln->edit_ix = paln->selectend_ix = i;
-					else
-					{
-						paln->selectend_ix = i;
-						if (paln->selectend_ix < paln->edit_ix) { uint32_t t = paln->selectend_ix; paln->selectend_ix = paln->edit_ix; paln->edit_ix = t; }
-					}
+					// a drag is one undo step, coalesced until the mouse is released
+					{ LPE_PROF_SCOPE("history record"); LPE_HistoryRecord(LPE_History(), paln, paln->edit_ix * sizeof(*c), sizeof(*c), paln->edit_ix + 1); }
+					c[paln->edit_ix] = (ImU32)ImColor(colf);
+					LPE_Changed(paln, paln->edit_ix * sizeof(*c), sizeof(*c));
 				}
-				ImGui::PopStyleColor();
-				if (ImGui::IsItemHovered()) ImGui::SetTooltip("Entry %d [0x%X]\n#%02X%02X%02X (%.2f,%.2f,%.2f)", i, i, col&0xFF, (col>>8)&0xFF, (col>>16)&0xFF, colf.x, colf.y, colf.z);
-				if ((i+1)%16 > 0 && i < pal->col_count-1) ImGui::SameLine();
-				ImGui::PopID();
+				ImGui::EndGroup();
+				ImGui::SameLine();
 			}
-			ImGui::EndGroup();
+			LPE_SwatchGrid(paln);
 
 			ImGui::PopID();
 		}
 		ImGui::EndDock();
+		LPE_Autosave(paln);
 		if (paln->need_save) lpe.need_save = true;
 	}
+	if (lpe.show_profiler) LPE_ProfDock(&lpe.show_profiler);
+	if (!ImGui::IsMouseDown(0)) LPE_HistoryBreak(LPE_History());
+	if (io.KeyCtrl && !io.WantTextInput)
+	{
+		if (ImGui::IsKeyPressed(io.KeyMap[ImGuiKey_Z])) LPE_Undo();
+		else if (ImGui::IsKeyPressed(io.KeyMap[ImGuiKey_Y])) LPE_Redo();
+	}
+
 	if (rem_paln)
 	{
 		if (!rem_paln->need_save) LPE_RemPalette(rem_paln);
@@ -229,4 +651,5 @@ void LPE_Tick(char* droppedFiles)
 		lpe.rem_paln_pending = 0;
 		break;
 	}
+	return LPE_Active();
 }
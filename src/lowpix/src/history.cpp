@@ -0,0 +1,165 @@
+#include <string.h>
+#include "lowpix.h"
+#include "history.h"
+
+enum
+{
+	LPE_HISTORY_RECENT = 8,       // entries this close to the cursor stay unpacked
+	LPE_HISTORY_PACK_MIN = 64,    // smaller ranges don't win anything packed
+	LPE_HISTORY_PACK_MAX = 1<<24, // lz77 header holds a 24 bit size
+};
+
+struct LPEHistoryEntry
+{
+	void* doc;
+	size_t off, size;
+	uint32_t key;
+	size_t packed;          // lz77 size of data, 0 if data is raw
+	uint8_t* data;          // bytes of the range on the other side of the edit
+};
+struct LPEHistory
+{
+	uint8_t* (*data)(void* doc, size_t* size);
+	size_t budget, used;
+	LPEHistoryEntry* e;
+	uint32_t count, cap, pos; // [0, pos) can be undone, [pos, count) redone
+	bool coalesce;          // the entry below pos may still grow
+};
+
+static size_t LPE_EntryBytes(LPEHistoryEntry* e) { return sizeof(*e) + (e->packed ? e->packed : e->size); }
+static void LPE_EntryPack(LPEHistory* h, LPEHistoryEntry* e)
+{
+	if (e->packed || e->size < LPE_HISTORY_PACK_MIN || e->size >= LPE_HISTORY_PACK_MAX) return;
+	size_t sz = e->size;
+	uint8_t* p = (uint8_t*)lp_cod_lz77(e->data, &sz);
+	if (!p) return;
+	if (sz >= e->size) { lp_alloc(p, 0); return; }
+	h->used -= e->size - sz;
+	lp_alloc(e->data, 0);
+	e->data = p, e->packed = sz;
+}
+static bool LPE_EntryUnpack(LPEHistory* h, LPEHistoryEntry* e)
+{
+	if (!e->packed) return true;
+	size_t sz = e->packed;
+	uint8_t* p = (uint8_t*)lp_dec_lz77(e->data, &sz);
+	if (!p || sz != e->size) { lp_alloc(p, 0); return false; }
+	h->used += e->size - e->packed;
+	lp_alloc(e->data, 0);
+	e->data = p, e->packed = 0;
+	return true;
+}
+// undo and redo are the same operation, the document and the entry trade their bytes
+static bool LPE_EntrySwap(LPEHistory* h, LPEHistoryEntry* e)
+{
+	size_t doc_sz;
+	uint8_t* d = h->data(e->doc, &doc_sz);
+	if (!d || e->off > doc_sz || e->size > doc_sz - e->off || !LPE_EntryUnpack(h, e)) return false;
+	for (size_t i = 0; i < e->size; ++i) { uint8_t t = d[e->off + i]; d[e->off + i] = e->data[i]; e->data[i] = t; }
+	return true;
+}
+static void LPE_HistoryRemove(LPEHistory* h, uint32_t i)
+{
+	h->used -= LPE_EntryBytes(&h->e[i]);
+	lp_alloc(h->e[i].data, 0);
+	memmove(&h->e[i], &h->e[i + 1], (h->count - i - 1) * sizeof(*h->e));
+	--h->count;
+	if (i < h->pos) --h->pos;
+}
+// packs the oldest entries first, then drops the oldest undo and the farthest redo, the entry at the cursor always stays
+static void LPE_HistoryTrim(LPEHistory* h)
+{
+	for (uint32_t i = 0; h->used > h->budget && i < h->count; ++i)
+		if (i + LPE_HISTORY_RECENT < h->pos || i >= h->pos + LPE_HISTORY_RECENT) LPE_EntryPack(h, &h->e[i]);
+	while (h->used > h->budget && h->pos > 1) LPE_HistoryRemove(h, 0);
+	while (h->used > h->budget && h->count > h->pos + 1) LPE_HistoryRemove(h, h->count - 1);
+}
+
+LPEHistory* LPE_HistoryNew(uint8_t* (*data)(void* doc, size_t* size), size_t budget)
+{
+	LPEHistory* h = (LPEHistory*)lp_zalloc(sizeof(LPEHistory));
+	h->data = data, h->budget = budget;
+	return h;
+}
+void LPE_HistoryFree(LPEHistory* h)
+{
+	if (!h) return;
+	for (uint32_t i = 0; i < h->count; ++i) lp_alloc(h->e[i].data, 0);
+	lp_alloc(h->e, 0); lp_alloc(h, 0);
+}
+void LPE_HistorySetBudget(LPEHistory* h, size_t budget) { h->budget = budget; LPE_HistoryTrim(h); }
+size_t LPE_HistoryUsed(LPEHistory* h) { return h->used; }
+
+void LPE_HistoryRecord(LPEHistory* h, void* doc, size_t off, size_t size, uint32_t key)
+{
+	size_t doc_sz;
+	uint8_t* d = h->data(doc, &doc_sz);
+	if (!d || size == 0 || off > doc_sz || size > doc_sz - off) return;
+	while (h->count > h->pos) { --h->count; h->used -= LPE_EntryBytes(&h->e[h->count]); lp_alloc(h->e[h->count].data, 0); }
+
+	LPEHistoryEntry* top = h->pos ? &h->e[h->pos - 1] : 0;
+	if (top && h->coalesce && key && top->key == key && top->doc == doc && LPE_EntryUnpack(h, top))
+	{
+		// bytes outside the entry haven't changed since it started, the document still holds their old value
+		size_t lo = off < top->off ? off : top->off, hi = off + size > top->off + top->size ? off + size : top->off + top->size;
+		if (lo < top->off || hi > top->off + top->size)
+		{
+			uint8_t* nd = (uint8_t*)lp_alloc(0, hi - lo);
+			memcpy(nd, d + lo, hi - lo);
+			memcpy(nd + (top->off - lo), top->data, top->size);
+			h->used += hi - lo - top->size;
+			lp_alloc(top->data, 0);
+			top->data = nd, top->off = lo, top->size = hi - lo;
+			LPE_HistoryTrim(h);
+		}
+		return;
+	}
+
+	if (h->count == h->cap)
+	{
+		h->cap = h->cap ? h->cap * 2 : 64;
+		h->e = (LPEHistoryEntry*)lp_alloc(h->e, h->cap * sizeof(*h->e));
+	}
+	LPEHistoryEntry* e = &h->e[h->count++];
+	e->doc = doc, e->off = off, e->size = size, e->key = key, e->packed = 0;
+	e->data = (uint8_t*)memcpy(lp_alloc(0, size), d + off, size);
+	h->used += LPE_EntryBytes(e);
+	h->pos = h->count;
+	h->coalesce = true;
+	if (h->pos > LPE_HISTORY_RECENT) LPE_EntryPack(h, &h->e[h->pos - 1 - LPE_HISTORY_RECENT]);
+	LPE_HistoryTrim(h);
+}
+void LPE_HistoryBreak(LPEHistory* h) { h->coalesce = false; }
+void LPE_HistoryForget(LPEHistory* h, void* doc)
+{
+	for (uint32_t i = h->count; i-- > 0;) if (h->e[i].doc == doc) LPE_HistoryRemove(h, i);
+	h->coalesce = false;
+}
+
+bool LPE_HistoryCanUndo(LPEHistory* h) { return h->pos > 0; }
+bool LPE_HistoryCanRedo(LPEHistory* h) { return h->pos < h->count; }
+// an entry that can't be applied anymore (its document shrank) is dropped
+void* LPE_HistoryUndo(LPEHistory* h, size_t* off, size_t* size)
+{
+	h->coalesce = false;
+	if (!h->pos) return 0;
+	LPEHistoryEntry* e = &h->e[--h->pos];
+	void* doc = e->doc;
+	if (!LPE_EntrySwap(h, e)) { LPE_HistoryRemove(h, h->pos); return 0; }
+	*off = e->off, *size = e->size;
+	if (h->pos + LPE_HISTORY_RECENT < h->count) LPE_EntryPack(h, &h->e[h->pos + LPE_HISTORY_RECENT]);
+	LPE_HistoryTrim(h);
+	return doc;
+}
+void* LPE_HistoryRedo(LPEHistory* h, size_t* off, size_t* size)
+{
+	h->coalesce = false;
+	if (h->pos == h->count) return 0;
+	LPEHistoryEntry* e = &h->e[h->pos++];
+	void* doc = e->doc;
+	if (!LPE_EntrySwap(h, e)) { LPE_HistoryRemove(h, h->pos - 1); return 0; }
+	*off = e->off, *size = e->size;
+	if (h->pos > LPE_HISTORY_RECENT) LPE_EntryPack(h, &h->e[h->pos - 1 - LPE_HISTORY_RECENT]);
+	LPE_HistoryTrim(h);
+	return doc;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Undo history of byte ranges changed in documents (palette colors, image pixels...).
+// Each entry keeps the bytes the range had on the other side of the edit, undo and redo swap them
+// with the document. Consecutive records with the same coalesce key merge into one entry until
+// LPE_HistoryBreak, older entries are lz77 packed and the oldest dropped to stay within the budget.
+
+struct LPEHistory;
+
+// data returns the document's bytes and their count, 0 if the document has none at the moment
+extern LPEHistory* LPE_HistoryNew(uint8_t* (*data)(void* doc, size_t* size), size_t budget);
+extern void LPE_HistoryFree(LPEHistory* h);
+extern void LPE_HistorySetBudget(LPEHistory* h, size_t budget);
+extern size_t LPE_HistoryUsed(LPEHistory* h); // bytes held by entries
+
+// call before [off, off+size) of doc changes, a key of 0 never coalesces
+extern void LPE_HistoryRecord(LPEHistory* h, void* doc, size_t off, size_t size, uint32_t key);
+extern void LPE_HistoryBreak(LPEHistory* h); // the next record starts a new entry
+extern void LPE_HistoryForget(LPEHistory* h, void* doc); // doc is gone, drops its entries
+
+extern bool LPE_HistoryCanUndo(LPEHistory* h);
+extern bool LPE_HistoryCanRedo(LPEHistory* h);
+// return the document that changed and the changed range, 0 if there was nothing to do
+extern void* LPE_HistoryUndo(LPEHistory* h, size_t* off, size_t* size);
+extern void* LPE_HistoryRedo(LPEHistory* h, size_t* off, size_t* size);
@@ -978,7 +978,7 @@ namespace ImGui
 		}
 
 
-		Dock* getDockByIndex(lua_Integer idx) { return idx < 0 ? nullptr : m_docks[(int)idx]; }
+		Dock* getDockByIndex(lua_Integer idx) { return idx < 0 || idx >= m_docks.size() ? nullptr : m_docks[(int)idx]; } // LP_FIX range check
 
 
 		void load(lua_State* L)
@@ -1013,6 +1013,7 @@ namespace ImGui
 						int idx = 0;
 						if (lua_getfield(L, -1, "index") == LUA_TNUMBER)
 							idx = (int)lua_tointeger(L, -1);
+						if (idx < 0 || idx >= m_docks.size()) idx = 0; // LP_FIX range check
 						Dock& dock = *m_docks[idx];
 						dock.last_frame = 0;
 						dock.invalid_frames = 0;
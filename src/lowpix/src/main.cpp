@@ -2,6 +2,7 @@
 //#include "imgui_impl_glfw_gl3.h"
 #include "imgui_impl_glfw.h"
 #include "lua.hpp"
+#include "profiler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <thread>
@@ -9,8 +10,13 @@
 #include <GLFW/glfw3.h>
 
 #define CONF "lowpix.lua"
+#define IDLE_TIMEOUT 1.0 // seconds
+#define DOCK_VERSION 1 // every dock saved, document docks named by session id
 
-extern void LPE_Tick(char* droppedFiles);
+extern bool LPE_Tick(char* droppedFiles);
+extern double LPE_IdleTimeout(double max);
+extern void LPE_Shutdown(void);
+void LPE_Wake(void) { glfwPostEmptyEvent(); }
 
 static void error_callback(int error, const char* description)
 {
@@ -46,7 +52,9 @@ int main(int argc, char* argv[])
 				if (lua_getfield(L, -1, "height") == LUA_TNUMBER) window_h = (int)lua_tonumber(L, -1); lua_pop(L, 1);
 			}
 			lua_pop(L, 1);
-			//ImGui::LoadDock(L);
+			// layouts of older versions index docks that weren't saved
+			if (lua_getglobal(L, "dock_version") == LUA_TNUMBER && lua_tointeger(L, -1) == DOCK_VERSION) ImGui::LoadDock(L);
+			lua_pop(L, 1);
 		}
 		lua_close(L);
 	}
@@ -80,13 +88,19 @@ int main(int argc, char* argv[])
 	double refreshPeriod = 1.0 / (monitorCount > 0 && monitors ? glfwGetVideoMode(monitors[0])->refreshRate : 60);
 	if (refreshPeriod < 1.0/60) refreshPeriod = 1.0/60;
 	double t0 = glfwGetTime();
+	// when the editor has nothing left to animate the loop blocks until an input event, a LPE_Wake
+	// from another thread, the editor's next deadline, or the timeout as a safety net
+	bool active = true;
     while (!glfwWindowShouldClose(window))
     {
-        glfwPollEvents();
+		double idle = active ? 0 : LPE_IdleTimeout(IDLE_TIMEOUT);
+		if (idle <= 0) glfwPollEvents();
+		else { glfwWaitEventsTimeout(idle); t0 = glfwGetTime(); }
+		LPE_ProfFrameBegin();
         //ImGui_ImplGlfwGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
 
-		LPE_Tick(s_droppedFiles);
+		active = LPE_Tick(s_droppedFiles);
 		s_droppedFiles[0] = 0, s_droppedFiles[1] = 0;
 
         // Rendering
@@ -95,8 +109,9 @@ int main(int argc, char* argv[])
         glViewport(0, 0, display_w, display_h);
         glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
         glClear(GL_COLOR_BUFFER_BIT);
-        ImGui::Render();
-        glfwSwapBuffers(window);
+        { LPE_PROF_SCOPE("ImGui::Render"); ImGui::Render(); }
+        { LPE_PROF_SCOPE("glfwSwapBuffers"); glfwSwapBuffers(window); }
+		LPE_ProfFrameEnd();
 
 		// delay
 		double t1 = glfwGetTime();
@@ -108,6 +123,7 @@ int main(int argc, char* argv[])
 			t0 = glfwGetTime();
 		}
     }
+	LPE_Shutdown();
 
 	{
 		FILE* f = fopen(CONF, "wb");
@@ -116,6 +132,7 @@ int main(int argc, char* argv[])
 			int w, h;
 			glfwGetWindowSize(window, &w, &h);
 			fprintf(f, "window_size = { width = %d, height = %d }\n", w, h);
+			fprintf(f, "dock_version = %d\n", DOCK_VERSION);
 			ImGui::SaveDock(f);
 			fclose(f);
 		}
@@ -0,0 +1,171 @@
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include "lowpix.h"
+#include "imgui.h"
+#include "tinyfiledialogs.h"
+#include "profiler.h"
+
+#define LPE_PROF_SCOPES 64 // distinct scope names followed by the overlay
+#define LPE_PROF_TOP 12    // scopes listed by the overlay
+
+// the ring wraps over events nobody read, seq tells readers whether a slot holds the event they expect
+// (index + 1) and was written completely
+struct LPEProfEvent
+{
+	std::atomic<uint64_t> seq;
+	std::atomic<const char*> name;
+	std::atomic<uint64_t> begin, end;
+	std::atomic<uint32_t> tid;
+};
+struct LPEProfStat
+{
+	const char* name;
+	float ms[LPE_PROF_FRAMES];   // time spent per frame, all threads together
+	uint32_t calls;              // during the last frame
+};
+static LPEProfEvent lpe_prof_ev[LPE_PROF_EVENTS];
+static std::atomic<uint64_t> lpe_prof_head(0);
+static std::atomic<uint32_t> lpe_prof_threads(0);
+static thread_local uint32_t lpe_prof_tid = 0;
+static struct
+{
+	uint64_t frame_begin;
+	uint64_t scan;               // next event to sum into a frame
+	uint32_t frame;              // frames ended so far
+	LPEProfStat stat[LPE_PROF_SCOPES];
+	uint32_t stat_count;
+	const char* selected;        // scope shown in the histogram
+} lpe_prof = {};
+
+uint64_t LPE_ProfBegin(void) { return lp_time_ns(); }
+void LPE_ProfEnd(const char* name, uint64_t begin)
+{
+	uint64_t end = lp_time_ns();
+	if (!lpe_prof_tid) lpe_prof_tid = ++lpe_prof_threads;
+	uint64_t i = lpe_prof_head.fetch_add(1, std::memory_order_relaxed);
+	LPEProfEvent& e = lpe_prof_ev[i & (LPE_PROF_EVENTS - 1)];
+	e.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	e.name.store(name, std::memory_order_relaxed);
+	e.begin.store(begin, std::memory_order_relaxed);
+	e.end.store(end, std::memory_order_relaxed);
+	e.tid.store(lpe_prof_tid, std::memory_order_relaxed);
+	e.seq.store(i + 1, std::memory_order_release);
+}
+// false while the slot is being written or already holds a later event
+static bool LPE_ProfRead(uint64_t i, const char** name, uint64_t* begin, uint64_t* end, uint32_t* tid)
+{
+	LPEProfEvent& e = lpe_prof_ev[i & (LPE_PROF_EVENTS - 1)];
+	if (e.seq.load(std::memory_order_acquire) != i + 1) return false;
+	*name = e.name.load(std::memory_order_relaxed);
+	*begin = e.begin.load(std::memory_order_relaxed), *end = e.end.load(std::memory_order_relaxed);
+	*tid = e.tid.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return e.seq.load(std::memory_order_relaxed) == i + 1;
+}
+
+void LPE_ProfFrameBegin(void) { lpe_prof.frame_begin = lp_time_ns(); }
+// events are summed into the frame they ended in, the scan stops at one still being written and
+// picks it up next frame
+void LPE_ProfFrameEnd(void)
+{
+	LPE_ProfEnd("frame", lpe_prof.frame_begin);
+	uint32_t slot = lpe_prof.frame % LPE_PROF_FRAMES;
+	for (uint32_t s = 0; s < lpe_prof.stat_count; ++s) lpe_prof.stat[s].ms[slot] = 0, lpe_prof.stat[s].calls = 0;
+	uint64_t head = lpe_prof_head.load(std::memory_order_acquire);
+	if (head - lpe_prof.scan > LPE_PROF_EVENTS) lpe_prof.scan = head - LPE_PROF_EVENTS;
+	for (; lpe_prof.scan < head; ++lpe_prof.scan)
+	{
+		const char* name; uint64_t begin, end; uint32_t tid;
+		if (!LPE_ProfRead(lpe_prof.scan, &name, &begin, &end, &tid)) break;
+		uint32_t s = 0;
+		for (; s < lpe_prof.stat_count && lpe_prof.stat[s].name != name; ++s);
+		if (s == lpe_prof.stat_count)
+		{
+			if (s == LPE_PROF_SCOPES) continue;
+			memset(&lpe_prof.stat[s], 0, sizeof(lpe_prof.stat[s]));
+			lpe_prof.stat[lpe_prof.stat_count++].name = name;
+		}
+		lpe_prof.stat[s].ms[slot] += (float)((end - begin) / 1e6);
+		++lpe_prof.stat[s].calls;
+	}
+	++lpe_prof.frame;
+}
+
+static float LPE_ProfValue(void* data, int ix) { return ((LPEProfStat*)data)->ms[ix]; }
+void LPE_ProfDock(bool* opened)
+{
+	if (ImGui::BeginDock("PROFILER", true, opened))
+	{
+		uint32_t count = lpe_prof.frame < LPE_PROF_FRAMES ? lpe_prof.frame : LPE_PROF_FRAMES;
+		float avg[LPE_PROF_SCOPES], max[LPE_PROF_SCOPES];
+		uint32_t order[LPE_PROF_SCOPES];
+		LPEProfStat* shown = 0;
+		for (uint32_t s = 0; s < lpe_prof.stat_count; ++s)
+		{
+			LPEProfStat& st = lpe_prof.stat[s];
+			avg[s] = 0, max[s] = 0, order[s] = s;
+			for (uint32_t f = 0; f < count; ++f) { avg[s] += st.ms[f]; if (st.ms[f] > max[s]) max[s] = st.ms[f]; }
+			if (count) avg[s] /= count;
+			if (st.name == lpe_prof.selected || (!shown && strcmp(st.name, "frame") == 0)) shown = &st;
+		}
+		// by average time per frame, insertion sort is plenty for a few dozen scopes
+		for (uint32_t i = 1; i < lpe_prof.stat_count; ++i)
+			for (uint32_t j = i; j > 0 && avg[order[j]] > avg[order[j - 1]]; --j) { uint32_t t = order[j]; order[j] = order[j - 1]; order[j - 1] = t; }
+
+		if (ImGui::Button("EXPORT TRACE"))
+		{
+			static const char* formats[] = { "*.json" };
+			if (const char* fn = tinyfd_saveFileDialog("Export Trace", "lowpix-trace.json", 1, formats, "Chrome Trace (*.json)"))
+				LPE_ProfExport(fn);
+		}
+		if (shown && count)
+		{
+			uint32_t s = (uint32_t)(shown - lpe_prof.stat);
+			char overlay[128];
+			snprintf(overlay, sizeof(overlay), "%s  %.2f ms avg  %.2f ms max", shown->name, avg[s], max[s]);
+			ImGui::PlotHistogramEx("##history", LPE_ProfValue, shown, (int)count, lpe_prof.frame < LPE_PROF_FRAMES ? 0 : (int)(lpe_prof.frame % LPE_PROF_FRAMES),
+				overlay, 0.0f, max[s] > 0 ? max[s] : 1.0f, ImVec2(ImGui::GetContentRegionAvailWidth(), 80), -1);
+		}
+		ImGui::Columns(4, "scopes");
+		ImGui::Text("scope"); ImGui::NextColumn();
+		ImGui::Text("avg ms"); ImGui::NextColumn();
+		ImGui::Text("max ms"); ImGui::NextColumn();
+		ImGui::Text("calls"); ImGui::NextColumn();
+		ImGui::Separator();
+		for (uint32_t i = 0; i < lpe_prof.stat_count && i < LPE_PROF_TOP; ++i)
+		{
+			LPEProfStat& st = lpe_prof.stat[order[i]];
+			if (ImGui::Selectable(st.name, &st == shown, ImGuiSelectableFlags_SpanAllColumns)) lpe_prof.selected = st.name;
+			ImGui::NextColumn();
+			ImGui::Text("%.3f", avg[order[i]]); ImGui::NextColumn();
+			ImGui::Text("%.3f", max[order[i]]); ImGui::NextColumn();
+			ImGui::Text("%u", st.calls); ImGui::NextColumn();
+		}
+		ImGui::Columns(1);
+	}
+	ImGui::EndDock();
+}
+
+// complete events ("ph":"X") in microseconds, one track per thread that recorded anything
+bool LPE_ProfExport(const char* fn)
+{
+	struct LPWriter* w = lp_w_open(fn);
+	if (!w) return false;
+	uint64_t head = lpe_prof_head.load(std::memory_order_acquire), i = head > LPE_PROF_EVENTS ? head - LPE_PROF_EVENTS : 0;
+	const char* sep = "";
+	lp_w_str(w, "{\"traceEvents\":[\n");
+	for (; i < head; ++i)
+	{
+		const char* name; uint64_t begin, end; uint32_t tid;
+		if (!LPE_ProfRead(i, &name, &begin, &end, &tid)) continue;
+		char ev[256];
+		snprintf(ev, sizeof(ev), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%llu.%03u}",
+			sep, name, tid, (unsigned long long)(begin / 1000), (unsigned)(begin % 1000), (unsigned long long)((end - begin) / 1000), (unsigned)((end - begin) % 1000));
+		lp_w_str(w, ev);
+		sep = ",\n";
+	}
+	lp_w_str(w, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	return lp_w_close(w) != 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+
+// Scoped timers of the editor. Every scope is one event in a shared ring (any thread, one atomic per event),
+// frames sum the events that ended during them per scope name so the overlay can show their history.
+// Names are string literals, scopes with the same literal are the same scope.
+
+#define LPE_PROF_FRAMES 256     // frames of history kept by the overlay
+#define LPE_PROF_EVENTS (1<<16) // events kept for the trace export
+
+extern uint64_t LPE_ProfBegin(void);
+extern void LPE_ProfEnd(const char* name, uint64_t begin);
+struct LPEProfScope
+{
+	const char* name;
+	uint64_t begin;
+	LPEProfScope(const char* name) : name(name), begin(LPE_ProfBegin()) {}
+	~LPEProfScope() { LPE_ProfEnd(name, begin); }
+};
+#define LPE_PROF_CAT2(a, b) a##b
+#define LPE_PROF_CAT(a, b) LPE_PROF_CAT2(a, b)
+#define LPE_PROF_SCOPE(name) LPEProfScope LPE_PROF_CAT(lpe_prof_, __LINE__)(name)
+
+// main thread, around everything a frame does besides waiting for events
+extern void LPE_ProfFrameBegin(void);
+extern void LPE_ProfFrameEnd(void);
+
+extern void LPE_ProfDock(bool* opened); // overlay with the frame time history and the hottest scopes
+extern bool LPE_ProfExport(const char* fn); // Chrome trace JSON of the events still in the ring
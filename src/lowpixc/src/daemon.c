@@ -0,0 +1,242 @@
+#ifdef __linux__
+#define _GNU_SOURCE // struct ucred
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "lowpixc.h"
+
+/*************************************************************************
+ * DAEMON
+ *
+ * lowpixc --serve SOCKET keeps one process alive so threads, color
+ * tables, remap tables and the cache stay warm between jobs, and
+ * lowpixc --connect SOCKET args... forwards a command line to it.
+ * Protocol, all integers u32 little endian:
+ *   request   'LPCQ' argc, then cwd and argc args each as len + bytes
+ *   stop      'LPCS'
+ *   response  'LPCR' exit code, len + messages
+ * Requests are run one at a time since each one changes the working
+ * directory and already uses every thread, so a client that stalls
+ * while sending or receiving is dropped after LPC_IO_TIMEOUT. The
+ * server runs command lines as its own user, connections from another
+ * user are refused. The cache index is saved after every request so a
+ * killed server keeps what it added.
+ *
+ * Lua states aren't kept between requests: a script's globals and
+ * loaded modules would leak into the next one, and a fresh state costs
+ * little next to the conversions it drives.
+ *************************************************************************/
+
+#define LPC_MAGIC_REQ   (0x5143504C) // LPCQ
+#define LPC_MAGIC_STOP  (0x5343504C) // LPCS
+#define LPC_MAGIC_RES   (0x5243504C) // LPCR
+#define LPC_ARG_MAX     (1 << 16)
+#define LPC_IO_TIMEOUT  (5)     // seconds
+#define LPC_RUN_TIMEOUT (600)   // seconds a client waits for the answer, requests run that long at most
+
+#ifdef WIN32
+int lpc_serve(const char* path, const char* cache_dir, struct LPWriter* out)
+{
+	lp_w_str(out, "error: --serve needs unix domain sockets\n");
+	return 1;
+}
+int lpc_connect(const char* path, int argc, char* const* argv, struct LPWriter* out, int* ret)
+{
+	return 0;
+}
+int lpc_stop(const char* path, struct LPWriter* out, int* ret)
+{
+	return 0;
+}
+#else
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int lpc_send(int fd, const void* data, size_t sz)
+{
+	for (const uint8_t* p = data; sz;)
+	{
+		ssize_t n = send(fd, p, sz, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return 0;
+		p += n, sz -= (size_t)n;
+	}
+	return 1;
+}
+static int lpc_recv(int fd, void* data, size_t sz)
+{
+	for (uint8_t* p = data; sz;)
+	{
+		ssize_t n = recv(fd, p, sz, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return 0;
+		p += n, sz -= (size_t)n;
+	}
+	return 1;
+}
+static int lpc_recv_u32(int fd, uint32_t* v)
+{
+	uint8_t b[4];
+	if (!lpc_recv(fd, b, 4)) return 0;
+	*v = lp_read_u32_le(b);
+	return 1;
+}
+static void lpc_w_u32(struct LPWriter* w, uint32_t v)
+{
+	uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+	lp_w_write(w, b, 4);
+}
+static void lpc_w_str(struct LPWriter* w, const char* s) { lpc_w_u32(w, (uint32_t)strlen(s)); lp_w_str(w, s); }
+static int lpc_socket(const char* path, struct sockaddr_un* addr)
+{
+	if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+static void lpc_timeout(int fd, int opt, long sec)
+{
+	struct timeval tv = { sec, 0 };
+	setsockopt(fd, SOL_SOCKET, opt, &tv, sizeof(tv));
+}
+static int lpc_peer_ok(int fd)
+{
+#ifdef __linux__
+	struct ucred cr;
+	socklen_t len = sizeof(cr);
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) == 0 && cr.uid == geteuid();
+#else
+	uid_t uid;
+	gid_t gid;
+	return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+// reads a request into a single allocation: argv pointers followed by the strings, returns argc, -2 for
+// a stop request or -1
+static int lpc_read_request(int fd, char*** argv_out, char** cwd)
+{
+	uint32_t magic, argc, len, total = 0;
+	if (!lpc_recv_u32(fd, &magic)) return -1;
+	if (magic == LPC_MAGIC_STOP) return -2;
+	if (magic != LPC_MAGIC_REQ || !lpc_recv_u32(fd, &argc) || argc > LPC_ARG_MAX) return -1;
+	char** argv = lp_alloc(0, (argc + 2) * sizeof(*argv));
+	char* s = 0;
+	uint32_t* offs = lp_alloc(0, (argc + 1) * sizeof(*offs));
+	for (uint32_t i = 0; i <= argc; ++i)
+	{
+		if (!lpc_recv_u32(fd, &len) || len > LPC_ARG_MAX) goto fail;
+		s = lp_alloc(s, total + len + 1);
+		if (!lpc_recv(fd, s + total, len)) goto fail;
+		s[total + len] = 0;
+		offs[i] = total, total += len + 1;
+	}
+	argv = lp_alloc(argv, (argc + 2) * sizeof(*argv) + total);
+	memcpy(argv + argc + 2, s, total);
+	*cwd = (char*)(argv + argc + 2) + offs[0];
+	argv[0] = "lowpixc";
+	for (uint32_t i = 1; i <= argc; ++i) argv[i] = (char*)(argv + argc + 2) + offs[i];
+	argv[argc + 1] = 0;
+	lp_alloc(s, 0); lp_alloc(offs, 0);
+	*argv_out = argv;
+	return (int)argc;
+fail:
+	lp_alloc(s, 0); lp_alloc(offs, 0); lp_alloc(argv, 0);
+	return -1;
+}
+
+int lpc_serve(const char* path, const char* cache_dir, struct LPWriter* out)
+{
+	struct sockaddr_un addr;
+	int sfd = lpc_socket(path, &addr);
+	if (sfd < 0) { lp_w_str(out, "error: can't create socket\n"); return 1; }
+	unlink(path); // stale socket from a previous server
+	if (bind(sfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sfd, 64) != 0)
+	{
+		lp_w_str(out, "error: can't listen on "); lp_w_str(out, path); lp_w_putc(out, '\n');
+		close(sfd);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	struct LPCache* cache = cache_dir ? lp_cache_open(cache_dir, 0) : 0;
+	char home[4096];
+	if (!getcwd(home, sizeof(home))) home[0] = 0;
+	for (int running = 1; running;)
+	{
+		int fd = accept(sfd, 0, 0);
+		if (fd < 0) { if (errno == EINTR) continue; break; }
+		lpc_timeout(fd, SO_RCVTIMEO, LPC_IO_TIMEOUT);
+		lpc_timeout(fd, SO_SNDTIMEO, LPC_IO_TIMEOUT);
+		char** argv = 0;
+		char* cwd = 0;
+		int peer = lpc_peer_ok(fd), argc = peer ? lpc_read_request(fd, &argv, &cwd) : -1;
+		struct LPWriter* w = lp_w_mem();
+		int ret = 1;
+		if (!peer) lp_w_str(w, "error: the server belongs to another user\n");
+		else if (argc == -2) running = 0, ret = 0;
+		else if (argc >= 0 && chdir(cwd) == 0) ret = lpc_main(argc + 1, argv, w, cache, 0);
+		else if (argc >= 0) lp_w_str(w, "error: server can't enter the client's working directory\n");
+		if (home[0] && chdir(home) != 0) running = 0;
+		if (cache && argc >= 0) lp_cache_save(cache);
+		size_t sz;
+		void* msg = lp_w_close_mem(w, &sz);
+		struct LPWriter* res = lp_w_mem();
+		lpc_w_u32(res, LPC_MAGIC_RES); lpc_w_u32(res, (uint32_t)ret); lpc_w_u32(res, (uint32_t)sz); lp_w_write(res, msg, sz);
+		void* data = lp_w_close_mem(res, &sz);
+		lpc_send(fd, data, sz);
+		close(fd);
+		lp_alloc(data, 0); lp_alloc(msg, 0); lp_alloc(argv, 0);
+	}
+	if (cache) lp_cache_close(cache);
+	close(sfd);
+	unlink(path);
+	return 0;
+}
+
+// sends the request in req (freed) and reads the answer
+static int lpc_exchange(const char* path, struct LPWriter* req, struct LPWriter* out, int* ret)
+{
+	size_t sz;
+	void* data = lp_w_close_mem(req, &sz);
+	struct sockaddr_un addr;
+	int fd = lpc_socket(path, &addr);
+	if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) close(fd), fd = -1;
+	if (fd < 0) { lp_alloc(data, 0); return 0; }
+	lpc_timeout(fd, SO_SNDTIMEO, LPC_IO_TIMEOUT);
+	lpc_timeout(fd, SO_RCVTIMEO, LPC_RUN_TIMEOUT);
+	signal(SIGPIPE, SIG_IGN);
+	uint32_t magic, code, len;
+	lpc_send(fd, data, sz); // a refusing server answers without reading it all
+	int ok = lpc_recv_u32(fd, &magic) && magic == LPC_MAGIC_RES && lpc_recv_u32(fd, &code) && lpc_recv_u32(fd, &len);
+	lp_alloc(data, 0);
+	if (ok)
+	{
+		lp_w_reserve(out, len);
+		if ((ok = lpc_recv(fd, out->buf + out->pos, len))) out->pos += len, *ret = (int)code;
+	}
+	close(fd);
+	// the server may have run part of the request, running it again here could do it twice
+	if (!ok) lp_w_str(out, "error: the server stopped answering\n"), *ret = 1;
+	return 1;
+}
+int lpc_connect(const char* path, int argc, char* const* argv, struct LPWriter* out, int* ret)
+{
+	char cwd[4096];
+	if (!getcwd(cwd, sizeof(cwd))) cwd[0] = 0; // the server refuses it
+	struct LPWriter* req = lp_w_mem();
+	lpc_w_u32(req, LPC_MAGIC_REQ); lpc_w_u32(req, (uint32_t)(argc - 1)); lpc_w_str(req, cwd);
+	for (int i = 1; i < argc; ++i) lpc_w_str(req, argv[i]);
+	return lpc_exchange(path, req, out, ret);
+}
+int lpc_stop(const char* path, struct LPWriter* out, int* ret)
+{
+	struct LPWriter* req = lp_w_mem();
+	lpc_w_u32(req, LPC_MAGIC_STOP);
+	return lpc_exchange(path, req, out, ret);
+}
+#endif
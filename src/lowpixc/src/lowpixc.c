@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "parg.h"
+#include "lowpixc.h"
+
+/*************************************************************************
+ * LOWPIXC
+ *
+ * Every input is an independent job run by lp_parallel_for, so -j sets
+ * the thread count. Jobs log to their own memory writer which is
+ * appended to the output in input order once all of them are done.
+ *************************************************************************/
+
+#define LPC_PATH_MAX (1024)
+#define LPC_WATCH_DEBOUNCE (100) // ms an input must stay unchanged before it's converted again
+
+enum LPCMode { LPC_PALETTE, LPC_REMAP, LPC_CODEC };
+static const struct LPCCodec lpc_codecs[] =
+{
+	{ "rle", lp_cod_rle_to, 0 }, { "huf4", lp_cod_huf4_to, 0 }, { "huf8", lp_cod_huf8_to, 0 }, { "lz77", lp_cod_lz77_to, 0 },
+	{ "unrle", lp_dec_rle_to, 1 }, { "unlz77", lp_dec_lz77_to, 1 },
+};
+const char* const lpc_dithers[] = { "none", "floyd", "atkinson", "bayer4", "bayer8", 0 };
+const char* const lpc_metrics[] = { "rgb", "cie76", "cie94", "oklab", 0 };
+
+struct LPCOptions
+{
+	enum LPCMode mode;
+	const char* out_fn;         // -o, single input only
+	const char* out_dir;        // -O
+	const char* ext;            // -f, output extension
+	const char* pal_fn;         // -p
+	struct LPPalette* pal;
+	uint64_t pal_key;
+	enum LPDither dither;
+	enum LPColorMetric metric;
+	const struct LPCCodec* codec;
+	int deps, quiet, bench;
+	const char* trace_fn;       // -T
+	struct LPCache* cache;
+};
+struct LPCBatch
+{
+	const struct LPCOptions* opt;
+	const char** in;
+	struct LPWriter** log;
+	int* result;
+	uint64_t* ns;           // per job, --bench only
+};
+
+static int lpc_find(const char* s, const char* const* names)
+{
+	for (int i = 0; names[i]; ++i) if (strcmp(s, names[i]) == 0) return i;
+	return -1;
+}
+const struct LPCCodec* lpc_codec(const char* name)
+{
+	for (size_t i = 0; i < sizeof(lpc_codecs) / sizeof(*lpc_codecs); ++i) if (strcmp(name, lpc_codecs[i].name) == 0) return &lpc_codecs[i];
+	return 0;
+}
+
+// output path: -o, or the input basename with ext in -O or next to the input
+static int lpc_out_path(const struct LPCOptions* opt, const char* in, const char* ext, char* out)
+{
+	if (opt->out_fn) return snprintf(out, LPC_PATH_MAX, "%s", opt->out_fn) < LPC_PATH_MAX;
+	const char *base = in, *dot = 0;
+	for (const char* s = in; *s; ++s) if (*s == '/' || *s == '\\') base = s + 1;
+	for (const char* s = base; *s; ++s) if (*s == '.') dot = s;
+	int base_len = dot ? (int)(dot - base) : (int)strlen(base);
+	int n = opt->out_dir ? snprintf(out, LPC_PATH_MAX, "%s/%.*s.%s", opt->out_dir, base_len, base, ext)
+		: snprintf(out, LPC_PATH_MAX, "%.*s%.*s.%s", (int)(base - in), in, base_len, base, ext);
+	return n > 0 && n < LPC_PATH_MAX;
+}
+static int lpc_save(const char* fn, const void* data, size_t sz)
+{
+	struct LPWriter* w = lp_w_open(fn); if (!w) return 0;
+	lp_w_write(w, data, sz);
+	return lp_w_close(w);
+}
+static void lpc_log(struct LPWriter* log, const char* a, const char* b, const char* c)
+{
+	lp_w_str(log, a); if (b) lp_w_str(log, b); if (c) lp_w_str(log, c); lp_w_putc(log, '\n');
+}
+
+static int lpc_convert_palette(const struct LPCOptions* opt, const char* in, const char* out, struct LPWriter* log)
+{
+	struct LPPalette* pal = lp_pal_load(in, 0, 0);
+	if (!pal) { lpc_log(log, "error: can't load palette ", in, 0); return 0; }
+	const char* deps[] = { in };
+	int ok = opt->deps ? lp_pal_save_dep(pal, out, LP_PALETTEFORMAT_EXT, deps, 1) : lp_pal_save(pal, out, LP_PALETTEFORMAT_EXT);
+	lp_alloc(pal, 0);
+	if (!ok) lpc_log(log, "error: can't write ", out, 0);
+	return ok;
+}
+// the output map truncates its file while the input is still mapped, windows refuses to open it instead
+static int lpc_same_file(const char* a, const char* b)
+{
+#ifdef WIN32
+	(void)a, (void)b;
+	return 0;
+#else
+	struct stat sa, sb;
+	return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+// codecs write straight into the output file mapped at the largest size it can have, then cut to the real size
+static int lpc_codec_save(const struct LPCOptions* opt, uint64_t key, void* data, size_t sz, const char* out, struct LPWriter* log)
+{
+	size_t cap = opt->codec->decode ? lp_dec_size(data, sz) : lp_cod_bound(sz);
+	if (!cap) { lpc_log(log, "error: can't convert to ", out, 0); return 0; }
+	struct LPFileMap* fm = lp_mmap_ex(out, 0, cap, LP_MAP_WRITE);
+	if (!fm) { lpc_log(log, "error: can't write ", out, 0); return 0; }
+	size_t n = opt->codec->to(data, sz, fm->mem, cap);
+	if (n && opt->cache) lp_cache_put(opt->cache, key, fm->mem, n);
+	int ok = lp_munmap_size(fm, n);
+	if (!n) { remove(out); lpc_log(log, "error: can't convert to ", out, 0); return 0; }
+	if (!ok) lpc_log(log, "error: can't write ", out, 0);
+	return ok;
+}
+// remap and codec results go through the cache, keyed on the input and every option that changes the output
+static int lpc_convert_data(const struct LPCOptions* opt, const char* in, const char* out, struct LPWriter* log)
+{
+	uint64_t key = 0;
+	if (opt->cache)
+	{
+		uint64_t params[5] = { opt->mode, opt->pal_key, opt->dither, opt->metric, opt->codec ? lp_hash64(opt->codec->name, strlen(opt->codec->name), 0) : 0 };
+		key = lp_cache_key(in, params, sizeof(params));
+		if (key && lp_cache_get_file(opt->cache, key, out)) return 1;
+	}
+	void* data = 0;
+	size_t sz = 0;
+	struct LPFileMap* fm = 0;
+	if (opt->mode == LPC_REMAP)
+	{
+		struct LPImage* img = lp_img_load(in, 0, 0);
+		if (!img) { lpc_log(log, "error: can't load image ", in, 0); return 0; }
+		data = lp_img_remap(img, opt->pal, opt->dither, opt->metric);
+		sz = (size_t)img->w * img->h;
+		lp_alloc(img, 0);
+	}
+	else
+	{
+		// codecs only read their input, so they work on the mapping
+		if (lpc_same_file(in, out)) { lpc_log(log, "error: output would overwrite its input ", in, 0); return 0; }
+		fm = lp_mmap_ex(in, 0, 0, LP_MAP_SEQUENTIAL);
+		if (!fm) { lpc_log(log, "error: can't read ", in, 0); return 0; }
+		data = fm->mem, sz = (size_t)fm->size;
+	}
+	if (!data) { lpc_log(log, "error: can't convert ", in, 0); return 0; }
+	int ok;
+	if (opt->codec) ok = lpc_codec_save(opt, key, data, sz, out, log);
+	else
+	{
+		ok = lpc_save(out, data, sz);
+		if (ok && opt->cache) lp_cache_put(opt->cache, key, data, sz);
+		if (!ok) lpc_log(log, "error: can't write ", out, 0);
+	}
+	if (fm) lp_munmap(fm);
+	else lp_alloc(data, 0);
+	return ok;
+}
+
+static void lpc_job(void* user, uint32_t ix)
+{
+	struct LPCBatch* b = user;
+	const struct LPCOptions* opt = b->opt;
+	const char* in = b->in[ix];
+	struct LPWriter* log = b->log[ix] = lp_w_mem();
+	uint64_t t0 = opt->bench ? lp_time_ns() : 0;
+	char out[LPC_PATH_MAX];
+	const char* ext = opt->ext ? opt->ext : opt->mode == LPC_CODEC && !opt->codec->decode ? opt->codec->name : "bin";
+	if (!lpc_out_path(opt, in, ext, out)) { lpc_log(log, "error: output path too long for ", in, 0); return; }
+	// everything the conversion allocates goes away with the arena, the log was made before so it survives
+	struct LPArena* arena = lp_arena_new(0), *prev = lp_arena_bind(arena);
+	int ok = opt->mode == LPC_PALETTE ? lpc_convert_palette(opt, in, out, log) : lpc_convert_data(opt, in, out, log);
+	if (ok && opt->deps && opt->mode != LPC_PALETTE)
+	{
+		char dep_fn[LPC_PATH_MAX + 2];
+		const char* targets[] = { out };
+		const char* deps[] = { in, opt->pal_fn };
+		snprintf(dep_fn, sizeof(dep_fn), "%s.d", out);
+		ok = lp_dep_save(dep_fn, targets, 1, deps, opt->mode == LPC_REMAP ? 2 : 1);
+		if (!ok) lpc_log(log, "error: can't write ", dep_fn, 0);
+	}
+	lp_arena_bind(prev);
+	lp_arena_free(arena);
+	if (ok && !opt->quiet) lpc_log(log, in, " -> ", out);
+	b->result[ix] = ok;
+	if (opt->bench) b->ns[ix] = lp_time_ns() - t0;
+}
+
+// converts in as one batch and appends the job logs to out, 1 if any of them failed
+static int lpc_run(const struct LPCOptions* opt, const char** in, uint32_t in_count, uint32_t jobs, uint64_t t0, struct LPWriter* out)
+{
+	struct LPCBatch b = { opt, in, lp_zalloc(in_count * sizeof(*b.log)), lp_zalloc(in_count * sizeof(*b.result)), lp_zalloc(in_count * sizeof(*b.ns)) };
+	int ret = 0;
+	if (jobs) lp_thread_set_count(jobs);
+	uint32_t threads = lp_thread_count();
+	uint64_t t1 = lp_time_ns();
+	lp_parallel_for(in_count, lpc_job, &b);
+	uint64_t t2 = lp_time_ns();
+	if (jobs) lp_thread_set_count(0);
+	for (uint32_t k = 0; k < in_count; ++k)
+	{
+		size_t sz;
+		void* msg = lp_w_close_mem(b.log[k], &sz);
+		lp_w_write(out, msg, sz);
+		lp_alloc(msg, 0);
+		if (!b.result[k]) ret = 1;
+	}
+	if (opt->bench)
+	{
+		uint64_t job_ns = 0, max_ns = 0;
+		for (uint32_t k = 0; k < in_count; ++k) job_ns += b.ns[k], max_ns = b.ns[k] > max_ns ? b.ns[k] : max_ns;
+		lp_w_str(out, "time: "); lp_w_dec(out, (int64_t)((t1 - t0) / 1000), 0); lp_w_str(out, " us setup, ");
+		lp_w_dec(out, (int64_t)((t2 - t1) / 1000), 0); lp_w_str(out, " us for "); lp_w_dec(out, in_count, 0); lp_w_str(out, " inputs on ");
+		lp_w_dec(out, threads, 0); lp_w_str(out, " threads, per input ");
+		lp_w_dec(out, (int64_t)(job_ns / in_count / 1000), 0); lp_w_str(out, " us average, "); lp_w_dec(out, (int64_t)(max_ns / 1000), 0); lp_w_str(out, " us max\n");
+	}
+	lp_alloc(b.ns, 0); lp_alloc(b.result, 0); lp_alloc(b.log, 0);
+	if (opt->trace_fn && !lp_trace_save(opt->trace_fn)) lpc_log(out, "warning: can't write trace ", opt->trace_fn, 0);
+	return ret;
+}
+// reruns the inputs that change on disk, all of them when the palette does, until the process is stopped
+static void lpc_watch(struct LPCOptions* opt, const char** in, uint32_t in_count, uint32_t jobs, struct LPWriter* out, void (*flush)(struct LPWriter* out))
+{
+	struct LPWatch* w = lp_watch_new(LPC_WATCH_DEBOUNCE);
+	const char** changed = lp_alloc(0, (in_count + 1) * sizeof(*changed));
+	for (uint32_t k = 0; k < in_count; ++k) lp_watch_add(w, in[k]);
+	if (opt->pal_fn) lp_watch_add(w, opt->pal_fn);
+	lpc_log(out, "watching for changes", 0, 0);
+	flush(out);
+	for (;;)
+	{
+		uint32_t n = lp_watch_poll(w, 1000, changed, in_count + 1);
+		if (!n) continue;
+		uint64_t t0 = lp_time_ns();
+		int all = 0;
+		for (uint32_t k = 0; k < n; ++k) if (opt->pal_fn && strcmp(changed[k], opt->pal_fn) == 0) all = 1;
+		if (all)
+		{
+			struct LPPalette* pal = lp_pal_load(opt->pal_fn, 0, 0);
+			if (!pal) { lpc_log(out, "error: can't load palette ", opt->pal_fn, 0); flush(out); continue; }
+			lp_alloc(opt->pal, 0);
+			opt->pal = pal;
+			opt->pal_key = lp_hash64(pal->col, pal->col_count * sizeof(*pal->col), 0);
+		}
+		lpc_run(opt, all ? in : changed, all ? in_count : n, jobs, t0, out);
+		flush(out);
+	}
+}
+
+static void lpc_usage(struct LPWriter* out)
+{
+	lp_w_str(out,
+		"usage: lowpixc [options] input...\n"
+		"  palettes are converted to the format of the output extension, with -p images are remapped\n"
+		"  to 8 bit indices, with -c files are run through a codec (after remapping if both are set)\n"
+		"  -o, --output FILE      output file, single input only\n"
+		"  -O, --outdir DIR       output directory, defaults to next to each input\n"
+		"  -f, --format EXT       output extension: bin act gpl s c o for palettes, default bin or the codec name\n"
+		"  -p, --palette FILE     remap images to this palette\n"
+		"  -d, --dither MODE      none floyd atkinson bayer4 bayer8 (default none)\n"
+		"  -m, --metric NAME      rgb cie76 cie94 oklab (default rgb)\n"
+		"  -c, --codec NAME       rle huf4 huf8 lz77 unrle unlz77\n"
+		"  -j, --jobs N           threads per batch, default and at most one per hardware thread\n"
+		"  -M, --deps             write a make dependency file next to each output\n"
+		"  -C, --cache DIR        reuse unchanged results from a cache directory\n"
+		"  -q, --quiet            only report errors\n"
+		"  -B, --bench            report times and memory use (allocation sites, peak, size histogram, leaks)\n"
+		"  -T, --trace FILE       write Chrome trace JSON of library calls (needs liblowpix built with --trace)\n"
+		"  -s, --script FILE      run a Lua script instead, inputs are its arguments (-j, -B and -T still apply)\n"
+		"  -w, --watch            keep running and convert inputs again when they or the palette change\n"
+		"  -V, --version\n"
+		"  -h, --help\n"
+		"       lowpixc --serve SOCKET [-C DIR]   keep a server running (unix domain socket), with one cache for all\n"
+		"       lowpixc --connect SOCKET args...  run args on that server, or here when none is running\n"
+		"       lowpixc --connect SOCKET --stop   stop the server\n");
+}
+
+int lpc_main(int argc, char* const* argv, struct LPWriter* out, struct LPCache* cache, void (*flush)(struct LPWriter* out))
+{
+	static const struct parg_option longopts[] =
+	{
+		{ "output", PARG_REQARG, 0, 'o' }, { "outdir", PARG_REQARG, 0, 'O' }, { "format", PARG_REQARG, 0, 'f' },
+		{ "palette", PARG_REQARG, 0, 'p' }, { "dither", PARG_REQARG, 0, 'd' }, { "metric", PARG_REQARG, 0, 'm' },
+		{ "codec", PARG_REQARG, 0, 'c' }, { "jobs", PARG_REQARG, 0, 'j' }, { "deps", PARG_NOARG, 0, 'M' },
+		{ "cache", PARG_REQARG, 0, 'C' }, { "quiet", PARG_NOARG, 0, 'q' }, { "bench", PARG_NOARG, 0, 'B' },
+		{ "trace", PARG_REQARG, 0, 'T' }, { "watch", PARG_NOARG, 0, 'w' }, { "script", PARG_REQARG, 0, 's' },
+		{ "version", PARG_NOARG, 0, 'V' }, { "help", PARG_NOARG, 0, 'h' }, { 0, 0, 0, 0 }
+	};
+	struct LPCOptions opt = { 0 };
+	const char *cache_dir = 0, *script = 0;
+	const char** in = lp_alloc(0, (argc + 1) * sizeof(*in));
+	uint32_t in_count = 0, jobs = 0;
+	int c, ret = 1, i, tracking = 0, watch = 0;
+	struct parg_state ps;
+	parg_init(&ps);
+	while ((c = parg_getopt_long(&ps, argc, argv, ":o:O:f:p:d:m:c:j:MC:qBT:ws:Vh", longopts, 0)) != -1)
+	{
+		switch (c)
+		{
+		case 1: in[in_count++] = ps.optarg; break;
+		case 'o': opt.out_fn = ps.optarg; break;
+		case 'O': opt.out_dir = ps.optarg; break;
+		case 'f': opt.ext = ps.optarg[0] == '.' ? ps.optarg + 1 : ps.optarg; break;
+		case 'p': opt.pal_fn = ps.optarg; break;
+		case 'd':
+			if ((i = lpc_find(ps.optarg, lpc_dithers)) < 0) { lpc_log(out, "error: unknown dither ", ps.optarg, 0); goto done; }
+			opt.dither = (enum LPDither)i;
+			break;
+		case 'm':
+			if ((i = lpc_find(ps.optarg, lpc_metrics)) < 0) { lpc_log(out, "error: unknown metric ", ps.optarg, 0); goto done; }
+			opt.metric = (enum LPColorMetric)i;
+			break;
+		case 'c':
+			if (!(opt.codec = lpc_codec(ps.optarg))) { lpc_log(out, "error: unknown codec ", ps.optarg, 0); goto done; }
+			break;
+		case 'j': jobs = (uint32_t)strtoul(ps.optarg, 0, 10); break;
+		case 'M': opt.deps = 1; break;
+		case 'C': cache_dir = ps.optarg; break;
+		case 'q': opt.quiet = 1; break;
+		case 'B': opt.bench = 1; break;
+		case 'T': opt.trace_fn = ps.optarg; break;
+		case 'w': watch = 1; break;
+		case 's': script = ps.optarg; break;
+		case 'V': lpc_log(out, "lowpixc ", LP_VERSION, 0); ret = 0; goto done;
+		case 'h': lpc_usage(out); ret = 0; goto done;
+		default:
+			lpc_log(out, c == ':' ? "error: missing argument for " : "error: unknown option ", argv[ps.optind - 1], 0);
+			goto done;
+		}
+	}
+	if (in_count == 0 && !script) { lpc_usage(out); goto done; }
+	if (script && watch) { lpc_log(out, "error: --watch doesn't apply to scripts", 0, 0); goto done; }
+	if (opt.out_fn && in_count > 1 && !script) { lpc_log(out, "error: -o needs a single input, use -O", 0, 0); goto done; }
+	if (watch && !flush) { lpc_log(out, "error: --watch needs a console", 0, 0); goto done; }
+	if (opt.bench) lp_mem_track(tracking = 1);
+	if (opt.trace_fn && !lp_trace_enable(1)) { lpc_log(out, "warning: liblowpix was built without tracing", 0, 0); opt.trace_fn = 0; }
+	if (script)
+	{
+		if (jobs) lp_thread_set_count(jobs);
+		ret = lpc_script(script, in, in_count, out);
+		if (jobs) lp_thread_set_count(0);
+		if (opt.trace_fn && !lp_trace_save(opt.trace_fn)) lpc_log(out, "warning: can't write trace ", opt.trace_fn, 0);
+		goto done;
+	}
+	uint64_t t0 = lp_time_ns();
+	opt.mode = opt.pal_fn ? LPC_REMAP : opt.codec ? LPC_CODEC : LPC_PALETTE;
+	if (opt.mode == LPC_PALETTE && !opt.ext && !opt.out_fn) { lpc_log(out, "error: palette conversion needs -f or -o", 0, 0); goto done; }
+	if (opt.mode == LPC_REMAP)
+	{
+		if (!(opt.pal = lp_pal_load(opt.pal_fn, 0, 0))) { lpc_log(out, "error: can't load palette ", opt.pal_fn, 0); goto done; }
+		opt.pal_key = lp_hash64(opt.pal->col, opt.pal->col_count * sizeof(*opt.pal->col), 0);
+	}
+	opt.cache = cache ? cache : cache_dir ? lp_cache_open(cache_dir, 0) : 0;
+	if (cache_dir && !opt.cache) lpc_log(out, "warning: can't open cache ", cache_dir, 0);
+
+	ret = lpc_run(&opt, in, in_count, jobs, t0, out);
+	if (watch) lpc_watch(&opt, in, in_count, jobs, out, flush);
+	if (opt.cache && !cache) lp_cache_close(opt.cache);
+done:
+	if (opt.trace_fn) lp_trace_enable(0);
+	lp_alloc(opt.pal, 0);
+	lp_alloc(in, 0);
+	if (tracking)
+	{
+		// after everything is freed so live blocks are leaks (or kept on purpose: the pool)
+		lp_remap_flush();
+		lp_mem_track(0);
+		lp_mem_report(out, 16);
+	}
+	return ret;
+}
@@ -0,0 +1,33 @@
+#ifndef LP_LOWPIXC_H
+#define LP_LOWPIXC_H
+
+#include "lowpix.h"
+
+// runs one command line (argv[0] is the program name) writing messages to out instead of stdout/stderr,
+// reentrant so the same code serves the console and the daemon; cache is used instead of -C when not 0,
+// --watch needs flush to hand out messages while it runs and doesn't return
+extern int lpc_main(int argc, char* const* argv, struct LPWriter* out, struct LPCache* cache, void (*flush)(struct LPWriter* out));
+
+// command line names, shared with scripts
+struct LPCCodec { const char* name; size_t (*to)(void* data, size_t data_sz, void* dst, size_t dst_cap); int decode; };
+extern const struct LPCCodec* lpc_codec(const char* name); // 0 if unknown
+extern const char* const lpc_dithers[]; // in enum LPDither order, 0 terminated
+extern const char* const lpc_metrics[]; // in enum LPColorMetric order, 0 terminated
+
+// SCRIPT - Lua with the lowpix module loaded, args become arg[1...] and the chunk's ...;
+// print goes to out; 1 if the script failed or returned false
+struct lua_State;
+extern int luaopen_lowpix(struct lua_State* L);
+extern int lpc_script(const char* fn, const char* const* args, uint32_t arg_count, struct LPWriter* out);
+
+// DAEMON - unix domain sockets only
+// runs command lines sent by lpc_connect until lpc_stop, cache_dir is kept open for all of them and its index
+// saved after each; only clients of the same user are served
+extern int lpc_serve(const char* path, const char* cache_dir, struct LPWriter* out);
+// sends argv[1..] with the current directory to the server, appends its messages to out and sets ret;
+// 0 if no server accepted the connection, once connected a server lost mid request is an error rather
+// than a reason to run it locally
+extern int lpc_connect(const char* path, int argc, char* const* argv, struct LPWriter* out, int* ret);
+extern int lpc_stop(const char* path, struct LPWriter* out, int* ret); // the same for the stop request
+
+#endif
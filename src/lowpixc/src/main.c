@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <string.h>
+#include "lowpixc.h"
+
+// messages of --watch rounds go out as they come
+static void lpc_flush(struct LPWriter* out)
+{
+	fwrite(out->buf, 1, out->pos, stdout);
+	fflush(stdout);
+	out->pos = 0;
+}
+
+// lowpixc --serve SOCKET [--cache DIR]  keeps a server running
+// lowpixc --connect SOCKET args...      runs args on the server, or locally if none is running
+// lowpixc --connect SOCKET --stop       stops the server
+int main(int argc, char** argv)
+{
+	struct LPWriter* out = lp_w_mem();
+	int ret = 1;
+	if (argc >= 3 && strcmp(argv[1], "--serve") == 0)
+	{
+		const char* cache_dir = argc >= 5 && (strcmp(argv[3], "--cache") == 0 || strcmp(argv[3], "-C") == 0) ? argv[4] : 0;
+		ret = lpc_serve(argv[2], cache_dir, out);
+	}
+	else if (argc >= 3 && strcmp(argv[1], "--connect") == 0)
+	{
+		// argv[2] takes the place of argv[0] for the forwarded command line
+		if (argc == 4 && strcmp(argv[3], "--stop") == 0)
+		{
+			if (!lpc_stop(argv[2], out, &ret)) lp_w_str(out, "error: no server running\n");
+		}
+		else if (!lpc_connect(argv[2], argc - 2, argv + 2, out, &ret))
+			ret = lpc_main(argc - 2, argv + 2, out, 0, lpc_flush);
+	}
+	else ret = lpc_main(argc, argv, out, 0, lpc_flush);
+	size_t sz;
+	void* msg = lp_w_close_mem(out, &sz);
+	fwrite(msg, 1, sz, ret ? stderr : stdout);
+	lp_alloc(msg, 0);
+	return ret;
+}
@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <string.h>
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lowpixc.h"
+
+/*************************************************************************
+ * SCRIPT
+ *
+ * The lowpix module hands Lua the library's own objects: Palette, Image
+ * and Buffer userdata hold the pointer liblowpix returned and free it
+ * when collected, indexing reads and writes the C arrays in place, 0
+ * based like the color indices they hold. Lua states are single
+ * threaded, so lowpix.map runs the items with lp_parallel_for_slot in
+ * a state per slot that loads a dump of the function once and is
+ * reused for every item that slot runs (globals an item sets stay for
+ * the next one there); what crosses states (items, results, upvalues)
+ * is limited to plain values, and print output is kept per item and
+ * appended in list order.
+ *************************************************************************/
+
+#define LPC_PALETTE "lowpix.Palette"
+#define LPC_IMAGE   "lowpix.Image"
+#define LPC_BUFFER  "lowpix.Buffer"
+#define LPC_PALETTE_MAX (1 << 24) // colors of lowpix.palette
+
+struct LPCBuffer { uint8_t* data; size_t size; struct LPFileMap* fm; /* read only mapping when set */ };
+
+static const char lpc_out_key = 0; // registry key of the writer print goes to
+static const char* const lpc_formats[] = { "bin", "act", "gpl", "asm", "c", "elf", 0 };
+
+static struct LPWriter* lpc_out(lua_State* L)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &lpc_out_key);
+	struct LPWriter* out = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return out;
+}
+static int lpc_print(lua_State* L)
+{
+	struct LPWriter* out = lpc_out(L);
+	for (int i = 1, n = lua_gettop(L); i <= n; ++i)
+	{
+		size_t sz;
+		const char* s = luaL_tolstring(L, i, &sz);
+		if (i > 1) lp_w_putc(out, '\t');
+		lp_w_write(out, s, sz);
+		lua_pop(L, 1);
+	}
+	lp_w_putc(out, '\n');
+	return 0;
+}
+// nil plus a message, for failures a script is expected to handle (files)
+static int lpc_fail(lua_State* L, const char* what, const char* fn)
+{
+	lua_pushnil(L);
+	lua_pushfstring(L, "%s%s", what, fn);
+	return 2;
+}
+
+static void lpc_push_pal(lua_State* L, struct LPPalette* pal)
+{
+	*(struct LPPalette**)lua_newuserdata(L, sizeof(pal)) = pal;
+	luaL_setmetatable(L, LPC_PALETTE);
+}
+static void lpc_push_img(lua_State* L, struct LPImage* img)
+{
+	*(struct LPImage**)lua_newuserdata(L, sizeof(img)) = img;
+	luaL_setmetatable(L, LPC_IMAGE);
+}
+static void lpc_push_buf(lua_State* L, void* data, size_t size, struct LPFileMap* fm)
+{
+	struct LPCBuffer* b = lua_newuserdata(L, sizeof(*b));
+	b->data = data, b->size = size, b->fm = fm;
+	luaL_setmetatable(L, LPC_BUFFER);
+}
+static struct LPPalette* lpc_pal(lua_State* L, int i) { return *(struct LPPalette**)luaL_checkudata(L, i, LPC_PALETTE); }
+static struct LPImage* lpc_img(lua_State* L, int i) { return *(struct LPImage**)luaL_checkudata(L, i, LPC_IMAGE); }
+static struct LPCBuffer* lpc_buf(lua_State* L, int i) { return luaL_checkudata(L, i, LPC_BUFFER); }
+// a Buffer or a string, read only either way
+static void* lpc_data(lua_State* L, int i, size_t* sz)
+{
+	struct LPCBuffer* b = luaL_testudata(L, i, LPC_BUFFER);
+	if (b) { *sz = b->size; return b->data; }
+	return (void*)luaL_checklstring(L, i, sz);
+}
+// index argument in [0, count)
+static uint32_t lpc_index(lua_State* L, int i, size_t count)
+{
+	lua_Integer ix = luaL_checkinteger(L, i);
+	luaL_argcheck(L, ix >= 0 && (size_t)ix < count, i, "index out of range");
+	return (uint32_t)ix;
+}
+static uint32_t lpc_color(lua_State* L, int i) { return (uint32_t)luaL_checkinteger(L, i); }
+
+// PALETTE
+static int lpc_pal_gc(lua_State* L) { struct LPPalette** p = luaL_checkudata(L, 1, LPC_PALETTE); lp_alloc(*p, 0); *p = 0; return 0; }
+static int lpc_pal_len(lua_State* L) { lua_pushinteger(L, lpc_pal(L, 1)->col_count); return 1; }
+static int lpc_pal_tostring(lua_State* L) { lua_pushfstring(L, "Palette (%d colors)", (int)lpc_pal(L, 1)->col_count); return 1; }
+// pal[i] reads nil past the end like a table, methods otherwise
+static int lpc_pal_get(lua_State* L)
+{
+	struct LPPalette* pal = lpc_pal(L, 1);
+	if (lua_type(L, 2) != LUA_TNUMBER) { lua_gettable(L, lua_upvalueindex(1)); return 1; }
+	lua_Integer ix = luaL_checkinteger(L, 2);
+	if (ix >= 0 && ix < pal->col_count) lua_pushinteger(L, pal->col[ix]);
+	else lua_pushnil(L);
+	return 1;
+}
+static int lpc_pal_set(lua_State* L)
+{
+	struct LPPalette* pal = lpc_pal(L, 1);
+	pal->col[lpc_index(L, 2, pal->col_count)] = lpc_color(L, 3);
+	return 0;
+}
+static int lpc_pal_save(lua_State* L)
+{
+	struct LPPalette* pal = lpc_pal(L, 1);
+	const char* fn = luaL_checkstring(L, 2);
+	enum LPPaletteFormat format = lua_isnoneornil(L, 3) ? LP_PALETTEFORMAT_EXT : (enum LPPaletteFormat)luaL_checkoption(L, 3, 0, lpc_formats);
+	if (!lp_pal_save(pal, fn, format)) return lpc_fail(L, "can't write ", fn);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+static int lpc_pal_clone(lua_State* L) { lpc_push_pal(L, lp_pal_clone(lpc_pal(L, 1))); return 1; }
+static int lpc_pal_unique(lua_State* L) { lpc_push_pal(L, lp_pal_unique(lpc_pal(L, 1))); return 1; }
+static int lpc_pal_restrict(lua_State* L) { lpc_push_pal(L, lp_pal_restrict(lpc_pal(L, 1))); return 1; }
+static int lpc_pal_concat(lua_State* L) { lpc_push_pal(L, lp_pal_concat(lpc_pal(L, 1), lpc_pal(L, 2))); return 1; }
+static int lpc_pal_lerp(lua_State* L) { lpc_push_pal(L, lp_pal_lerp(lpc_pal(L, 1), lpc_pal(L, 2), (float)luaL_checknumber(L, 3))); return 1; }
+// pal:fade(pal2 or color, steps)
+static int lpc_pal_fade(lua_State* L)
+{
+	struct LPPalette* pal = lpc_pal(L, 1);
+	struct LPPalette** to = luaL_testudata(L, 2, LPC_PALETTE);
+	uint32_t col = to ? 0 : lpc_color(L, 2);
+	lua_Integer steps = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, steps > 0, 3, "needs at least one step");
+	lpc_push_pal(L, lp_pal_fade(pal, to ? *to : 0, col, (uint32_t)steps));
+	return 1;
+}
+static int lpc_pal_cycle(lua_State* L)
+{
+	struct LPPalette* pal = lpc_pal(L, 1);
+	uint32_t first = lpc_index(L, 2, pal->col_count);
+	lua_Integer count = luaL_checkinteger(L, 3), steps = luaL_checkinteger(L, 4);
+	luaL_argcheck(L, count > 0 && first + count <= pal->col_count, 3, "range out of the palette");
+	luaL_argcheck(L, steps > 0, 4, "needs at least one step");
+	lpc_push_pal(L, lp_pal_cycle(pal, first, (uint32_t)count, (uint32_t)steps));
+	return 1;
+}
+
+// IMAGE
+static int lpc_img_gc(lua_State* L) { struct LPImage** p = luaL_checkudata(L, 1, LPC_IMAGE); lp_alloc(*p, 0); *p = 0; return 0; }
+static int lpc_img_tostring(lua_State* L) { struct LPImage* img = lpc_img(L, 1); lua_pushfstring(L, "Image (%dx%d)", (int)img->w, (int)img->h); return 1; }
+static int lpc_img_get(lua_State* L)
+{
+	struct LPImage* img = lpc_img(L, 1);
+	const char* key = lua_type(L, 2) == LUA_TSTRING ? lua_tostring(L, 2) : 0;
+	if (key && strcmp(key, "w") == 0) lua_pushinteger(L, img->w);
+	else if (key && strcmp(key, "h") == 0) lua_pushinteger(L, img->h);
+	else lua_gettable(L, lua_upvalueindex(1));
+	return 1;
+}
+static int lpc_img_pixel(lua_State* L)
+{
+	struct LPImage* img = lpc_img(L, 1);
+	uint32_t x = lpc_index(L, 2, img->w), y = lpc_index(L, 3, img->h);
+	lua_pushinteger(L, img->pix[(size_t)y * img->w + x]);
+	return 1;
+}
+static int lpc_img_set_pixel(lua_State* L)
+{
+	struct LPImage* img = lpc_img(L, 1);
+	uint32_t x = lpc_index(L, 2, img->w), y = lpc_index(L, 3, img->h);
+	img->pix[(size_t)y * img->w + x] = lpc_color(L, 4);
+	return 0;
+}
+static int lpc_img_clone(lua_State* L) { lpc_push_img(L, lp_img_clone(lpc_img(L, 1))); return 1; }
+// img:remap(pal, dither, metric) -> Buffer of w*h indices
+static int lpc_img_remap(lua_State* L)
+{
+	struct LPImage* img = lpc_img(L, 1);
+	struct LPPalette* pal = lpc_pal(L, 2);
+	int dither = luaL_checkoption(L, 3, "none", lpc_dithers), metric = luaL_checkoption(L, 4, "rgb", lpc_metrics);
+	uint8_t* ix = lp_img_remap(img, pal, (enum LPDither)dither, (enum LPColorMetric)metric);
+	if (!ix) return lpc_fail(L, "can't remap", "");
+	lpc_push_buf(L, ix, (size_t)img->w * img->h, 0);
+	return 1;
+}
+
+// BUFFER
+static int lpc_buf_gc(lua_State* L)
+{
+	struct LPCBuffer* b = lpc_buf(L, 1);
+	if (b->fm) lp_munmap(b->fm);
+	else lp_alloc(b->data, 0);
+	b->data = 0, b->size = 0, b->fm = 0;
+	return 0;
+}
+static int lpc_buf_len(lua_State* L) { lua_pushinteger(L, (lua_Integer)lpc_buf(L, 1)->size); return 1; }
+static int lpc_buf_tostring(lua_State* L) { lua_pushfstring(L, "Buffer (%I bytes)", (lua_Integer)lpc_buf(L, 1)->size); return 1; }
+static int lpc_buf_get(lua_State* L)
+{
+	struct LPCBuffer* b = lpc_buf(L, 1);
+	if (lua_type(L, 2) != LUA_TNUMBER) { lua_gettable(L, lua_upvalueindex(1)); return 1; }
+	lua_Integer ix = luaL_checkinteger(L, 2);
+	if (ix >= 0 && (size_t)ix < b->size) lua_pushinteger(L, b->data[ix]);
+	else lua_pushnil(L);
+	return 1;
+}
+static int lpc_buf_set(lua_State* L)
+{
+	struct LPCBuffer* b = lpc_buf(L, 1);
+	uint32_t ix = lpc_index(L, 2, b->size);
+	luaL_argcheck(L, !b->fm, 1, "buffer is a read only file mapping");
+	b->data[ix] = (uint8_t)luaL_checkinteger(L, 3);
+	return 0;
+}
+static int lpc_buf_save(lua_State* L)
+{
+	struct LPCBuffer* b = lpc_buf(L, 1);
+	const char* fn = luaL_checkstring(L, 2);
+	struct LPWriter* w = lp_w_open(fn);
+	if (w) lp_w_write(w, b->data, b->size);
+	if (!w || !lp_w_close(w)) return lpc_fail(L, "can't write ", fn);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+static int lpc_buf_string(lua_State* L) { struct LPCBuffer* b = lpc_buf(L, 1); lua_pushlstring(L, (const char*)b->data, b->size); return 1; }
+
+// MODULE
+static int lpc_pal_load(lua_State* L)
+{
+	const char* fn = luaL_checkstring(L, 1);
+	size_t sz = 0;
+	void* data = lua_isnoneornil(L, 2) ? 0 : lpc_data(L, 2, &sz);
+	struct LPPalette* pal = lp_pal_load(fn, data, sz);
+	if (!pal) return lpc_fail(L, "can't load palette ", fn);
+	lpc_push_pal(L, pal);
+	return 1;
+}
+// lowpix.palette(count) cleared to 0, or lowpix.palette{ colors }
+static int lpc_pal_new(lua_State* L)
+{
+	int table = lua_istable(L, 1);
+	lua_Integer count = table ? (lua_Integer)lua_rawlen(L, 1) : luaL_checkinteger(L, 1);
+	luaL_argcheck(L, count >= 0 && count <= LPC_PALETTE_MAX, 1, "bad color count");
+	struct LPPalette* pal = lp_zalloc(offsetof(struct LPPalette, col[count]));
+	pal->col_count = (uint32_t)count;
+	lpc_push_pal(L, pal);
+	for (lua_Integer i = 0; table && i < count; ++i)
+	{
+		if (lua_rawgeti(L, 1, i + 1) != LUA_TNUMBER || !lua_isinteger(L, -1)) return luaL_argerror(L, 1, "colors must be integers");
+		pal->col[i] = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	return 1;
+}
+static int lpc_img_load(lua_State* L)
+{
+	const char* fn = luaL_checkstring(L, 1);
+	size_t sz = 0;
+	void* data = lua_isnoneornil(L, 2) ? 0 : lpc_data(L, 2, &sz);
+	struct LPImage* img = lp_img_load(fn, data, sz);
+	if (!img) return lpc_fail(L, "can't load image ", fn);
+	lpc_push_img(L, img);
+	return 1;
+}
+static int lpc_img_new(lua_State* L)
+{
+	lua_Integer w = luaL_checkinteger(L, 1), h = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, w > 0 && w <= 65536 && h > 0 && h <= 65536, 1, "bad image size");
+	lpc_push_img(L, lp_img_new((uint32_t)w, (uint32_t)h));
+	return 1;
+}
+// the file mapped, nothing is read until used
+static int lpc_buf_load(lua_State* L)
+{
+	const char* fn = luaL_checkstring(L, 1);
+	struct LPFileMap* fm = lp_mmap(fn);
+	if (!fm) return lpc_fail(L, "can't read ", fn);
+	lpc_push_buf(L, fm->mem, (size_t)fm->size, fm);
+	return 1;
+}
+// lowpix.buffer(size) cleared to 0, or a copy of a string
+static int lpc_buf_new(lua_State* L)
+{
+	size_t sz;
+	const char* s = lua_type(L, 1) == LUA_TSTRING ? lua_tolstring(L, 1, &sz) : 0;
+	if (!s)
+	{
+		lua_Integer n = luaL_checkinteger(L, 1);
+		luaL_argcheck(L, n >= 0, 1, "bad size");
+		sz = (size_t)n;
+	}
+	uint8_t* data = lp_zalloc(sz ? sz : 1);
+	if (s) memcpy(data, s, sz);
+	lpc_push_buf(L, data, sz, 0);
+	return 1;
+}
+// lowpix.codec(data, name) with the names of lowpixc -c
+static int lpc_codec_run(lua_State* L)
+{
+	size_t sz;
+	void* data = lpc_data(L, 1, &sz);
+	const struct LPCCodec* c = lpc_codec(luaL_checkstring(L, 2));
+	luaL_argcheck(L, c, 2, "unknown codec");
+	size_t cap = c->decode ? lp_dec_size(data, sz) : lp_cod_bound(sz);
+	uint8_t* dst = cap ? lp_alloc(0, cap) : 0;
+	size_t n = dst ? c->to(data, sz, dst, cap) : 0;
+	if (!n)
+	{
+		if (dst) lp_alloc(dst, 0);
+		return lpc_fail(L, "can't convert with ", c->name);
+	}
+	lpc_push_buf(L, lp_alloc(dst, n), n, 0);
+	return 1;
+}
+static int lpc_color_new(lua_State* L)
+{
+	lua_Integer r = luaL_checkinteger(L, 1), g = luaL_checkinteger(L, 2), b = luaL_checkinteger(L, 3);
+	lua_pushinteger(L, (r & 255) | (g & 255) << 8 | (b & 255) << 16);
+	return 1;
+}
+static int lpc_color_rgb(lua_State* L)
+{
+	uint32_t col = lpc_color(L, 1);
+	lua_pushinteger(L, col & 255); lua_pushinteger(L, col >> 8 & 255); lua_pushinteger(L, col >> 16 & 255);
+	return 3;
+}
+
+// MAP
+enum LPCValueType { LPC_NIL, LPC_BOOLEAN, LPC_INTEGER, LPC_NUMBER, LPC_STRING, LPC_GLOBALS, LPC_MODULE };
+struct LPCValue
+{
+	enum LPCValueType type;
+	lua_Integer i;          // booleans too
+	lua_Number n;
+	const char* s;          // owned by the state it was read from, or by lp_alloc for results
+	size_t len;
+};
+struct LPCMap
+{
+	struct LPWriter* code;
+	const struct LPCValue *up, *item;
+	uint32_t up_count;
+	struct LPCValue* result;
+	char** error;
+	struct LPWriter** log;
+	lua_State** state; // per slot, holding the loaded function at index 1
+};
+
+static int lpc_is_module(lua_State* L, int i)
+{
+	i = lua_absindex(L, i);
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	lua_getfield(L, -1, "lowpix");
+	int is = lua_rawequal(L, i, -1);
+	lua_pop(L, 2);
+	return is;
+}
+// 0 if the value can't move to another state
+static int lpc_value_get(lua_State* L, int i, struct LPCValue* v, int copy)
+{
+	memset(v, 0, sizeof(*v));
+	switch (lua_type(L, i))
+	{
+	case LUA_TNIL: v->type = LPC_NIL; return 1;
+	case LUA_TBOOLEAN: v->type = LPC_BOOLEAN, v->i = lua_toboolean(L, i); return 1;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, i)) v->type = LPC_INTEGER, v->i = lua_tointeger(L, i);
+		else v->type = LPC_NUMBER, v->n = lua_tonumber(L, i);
+		return 1;
+	case LUA_TSTRING:
+		v->type = LPC_STRING, v->s = lua_tolstring(L, i, &v->len);
+		if (copy) v->s = memcpy(lp_alloc(0, v->len + 1), v->s, v->len + 1);
+		return 1;
+	case LUA_TTABLE:
+		if (!lpc_is_module(L, i)) return 0;
+		v->type = LPC_MODULE;
+		return 1;
+	}
+	return 0;
+}
+static void lpc_value_push(lua_State* L, const struct LPCValue* v)
+{
+	switch (v->type)
+	{
+	case LPC_NIL: lua_pushnil(L); break;
+	case LPC_BOOLEAN: lua_pushboolean(L, (int)v->i); break;
+	case LPC_INTEGER: lua_pushinteger(L, v->i); break;
+	case LPC_NUMBER: lua_pushnumber(L, v->n); break;
+	case LPC_STRING: lua_pushlstring(L, v->s, v->len); break;
+	case LPC_GLOBALS: lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS); break;
+	case LPC_MODULE: luaL_requiref(L, "lowpix", luaopen_lowpix, 0); break;
+	}
+}
+
+static lua_State* lpc_state(struct LPWriter* out)
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaL_requiref(L, "lowpix", luaopen_lowpix, 1);
+	lua_pop(L, 1);
+	lua_pushlightuserdata(L, out);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &lpc_out_key);
+	lua_register(L, "print", lpc_print);
+	return L;
+}
+static int lpc_dump_write(lua_State* L, const void* p, size_t sz, void* w) { (void)L; lp_w_write(w, p, sz); return 0; }
+
+static void lpc_map_job(void* user, uint32_t ix, uint32_t slot)
+{
+	struct LPCMap* m = user;
+	lua_State* L = m->state[slot];
+	int ok = 1;
+	if (!L)
+	{
+		L = m->state[slot] = lpc_state(0);
+		ok = luaL_loadbuffer(L, (const char*)m->code->buf, m->code->pos, "=map") == LUA_OK;
+		for (uint32_t u = 0; ok && u < m->up_count; ++u) { lpc_value_push(L, &m->up[u]); lua_setupvalue(L, -2, (int)u + 1); }
+		if (!ok) m->state[slot] = 0; // closed below, the next item tries again
+	}
+	lua_pushlightuserdata(L, m->log[ix] = lp_w_mem());
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &lpc_out_key);
+	if (ok)
+	{
+		lua_pushvalue(L, 1);
+		lpc_value_push(L, &m->item[ix]);
+		ok = lua_pcall(L, 1, 1, 0) == LUA_OK;
+	}
+	if (ok && !lpc_value_get(L, -1, &m->result[ix], 1))
+	{
+		lua_pushfstring(L, "result must be nil, a boolean, a number or a string (got %s)", luaL_typename(L, -1));
+		ok = 0;
+	}
+	if (!ok)
+	{
+		size_t len;
+		const char* msg = lua_tolstring(L, -1, &len);
+		if (!msg) msg = "error object is not a string", len = strlen(msg);
+		m->error[ix] = memcpy(lp_alloc(0, len + 1), msg, len + 1);
+	}
+	if (m->state[slot]) lua_settop(L, 1);
+	else lua_close(L);
+}
+// lowpix.map(fn, items) -> results, fn(item) runs on the thread pool in a state per thread
+static int lpc_map(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_argcheck(L, !lua_iscfunction(L, 1), 1, "Lua function expected");
+	lua_settop(L, 2);
+	uint32_t count = (uint32_t)lua_rawlen(L, 2), up_count = 0;
+	lua_Debug ar;
+	lua_pushvalue(L, 1);
+	lua_getinfo(L, ">u", &ar);
+	up_count = ar.nups;
+
+	// the arrays are userdata so errors don't leak them; strings stay valid as their table and function are on the stack
+	struct LPCValue* up = lua_newuserdata(L, (up_count + 1) * sizeof(*up));
+	struct LPCValue* item = lua_newuserdata(L, (count + 1) * sizeof(*item));
+	for (uint32_t u = 0; u < up_count; ++u)
+	{
+		const char* name = lua_getupvalue(L, 1, (int)u + 1);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+		int globals = lua_rawequal(L, -1, -2);
+		lua_pop(L, 1);
+		if (globals) up[u].type = LPC_GLOBALS;
+		else if (!lpc_value_get(L, -1, &up[u], 0))
+			return luaL_error(L, "map: upvalue '%s' must be nil, a boolean, a number, a string or the lowpix module", name);
+		lua_pop(L, 1);
+	}
+	for (uint32_t k = 0; k < count; ++k)
+	{
+		lua_rawgeti(L, 2, (lua_Integer)k + 1);
+		if (!lpc_value_get(L, -1, &item[k], 0)) return luaL_error(L, "map: item %d must be nil, a boolean, a number or a string", (int)k + 1);
+		lua_pop(L, 1);
+	}
+
+	uint32_t slots = lp_thread_count();
+	struct LPCMap m = { lp_w_mem(), up, item, up_count, lp_zalloc((count + 1) * sizeof(*m.result)),
+		lp_zalloc((count + 1) * sizeof(*m.error)), lp_zalloc((count + 1) * sizeof(*m.log)),
+		lp_zalloc(slots * sizeof(*m.state)) };
+	lua_pushvalue(L, 1);
+	lua_dump(L, lpc_dump_write, m.code, 0);
+	lua_pop(L, 1);
+	lp_parallel_for_slot(count, lpc_map_job, &m);
+	for (uint32_t s = 0; s < slots; ++s) if (m.state[s]) lua_close(m.state[s]);
+
+	struct LPWriter* out = lpc_out(L);
+	int failed = -1;
+	lua_createtable(L, (int)count, 0);
+	for (uint32_t k = 0; k < count; ++k)
+	{
+		size_t sz;
+		void* msg = lp_w_close_mem(m.log[k], &sz);
+		lp_w_write(out, msg, sz);
+		lp_alloc(msg, 0);
+		if (m.error[k] && failed < 0) failed = (int)k;
+		lpc_value_push(L, &m.result[k]);
+		lua_rawseti(L, -2, (lua_Integer)k + 1);
+		if (m.result[k].type == LPC_STRING) lp_alloc((void*)m.result[k].s, 0);
+	}
+	if (failed >= 0) lua_pushfstring(L, "map: item %d: %s", failed + 1, m.error[failed]);
+	for (uint32_t k = 0; k < count; ++k) if (m.error[k]) lp_alloc(m.error[k], 0);
+	lp_alloc(m.log, 0); lp_alloc(m.error, 0); lp_alloc(m.result, 0); lp_alloc(m.state, 0);
+	lp_w_close(m.code);
+	return failed >= 0 ? lua_error(L) : 1;
+}
+
+static void lpc_type(lua_State* L, const char* name, const luaL_Reg* meta, lua_CFunction index, const luaL_Reg* methods)
+{
+	luaL_newmetatable(L, name);
+	luaL_setfuncs(L, meta, 0);
+	lua_newtable(L); // methods, looked up by the __index function
+	luaL_setfuncs(L, methods, 0);
+	lua_pushcclosure(L, index, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+}
+int luaopen_lowpix(lua_State* L)
+{
+	static const luaL_Reg pal_meta[] = { { "__gc", lpc_pal_gc }, { "__len", lpc_pal_len }, { "__newindex", lpc_pal_set }, { "__tostring", lpc_pal_tostring }, { 0, 0 } };
+	static const luaL_Reg pal_methods[] =
+	{
+		{ "save", lpc_pal_save }, { "clone", lpc_pal_clone }, { "unique", lpc_pal_unique }, { "restrict", lpc_pal_restrict },
+		{ "concat", lpc_pal_concat }, { "lerp", lpc_pal_lerp }, { "fade", lpc_pal_fade }, { "cycle", lpc_pal_cycle }, { 0, 0 }
+	};
+	static const luaL_Reg img_meta[] = { { "__gc", lpc_img_gc }, { "__tostring", lpc_img_tostring }, { 0, 0 } };
+	static const luaL_Reg img_methods[] = { { "pixel", lpc_img_pixel }, { "set_pixel", lpc_img_set_pixel }, { "clone", lpc_img_clone }, { "remap", lpc_img_remap }, { 0, 0 } };
+	static const luaL_Reg buf_meta[] = { { "__gc", lpc_buf_gc }, { "__len", lpc_buf_len }, { "__newindex", lpc_buf_set }, { "__tostring", lpc_buf_tostring }, { 0, 0 } };
+	static const luaL_Reg buf_methods[] = { { "save", lpc_buf_save }, { "string", lpc_buf_string }, { 0, 0 } };
+	static const luaL_Reg lib[] =
+	{
+		{ "pal_load", lpc_pal_load }, { "palette", lpc_pal_new }, { "img_load", lpc_img_load }, { "image", lpc_img_new },
+		{ "load", lpc_buf_load }, { "buffer", lpc_buf_new }, { "codec", lpc_codec_run }, { "color", lpc_color_new },
+		{ "rgb", lpc_color_rgb }, { "map", lpc_map }, { 0, 0 }
+	};
+	lpc_type(L, LPC_PALETTE, pal_meta, lpc_pal_get, pal_methods);
+	lpc_type(L, LPC_IMAGE, img_meta, lpc_img_get, img_methods);
+	lpc_type(L, LPC_BUFFER, buf_meta, lpc_buf_get, buf_methods);
+	luaL_newlib(L, lib);
+	lua_pushliteral(L, LP_VERSION);
+	lua_setfield(L, -2, "version");
+	return 1;
+}
+
+static int lpc_traceback(lua_State* L)
+{
+	const char* msg = lua_tostring(L, 1);
+	luaL_traceback(L, L, msg ? msg : lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, 1)), 1);
+	return 1;
+}
+int lpc_script(const char* fn, const char* const* args, uint32_t arg_count, struct LPWriter* out)
+{
+	lua_State* L = lpc_state(out);
+	lua_createtable(L, (int)arg_count, 1);
+	lua_pushstring(L, fn);
+	lua_rawseti(L, -2, 0);
+	for (uint32_t i = 0; i < arg_count; ++i) { lua_pushstring(L, args[i]); lua_rawseti(L, -2, (lua_Integer)i + 1); }
+	lua_setglobal(L, "arg");
+	lua_pushcfunction(L, lpc_traceback);
+	int status = luaL_loadfile(L, fn), ret;
+	if (status == LUA_OK)
+	{
+		luaL_checkstack(L, (int)arg_count, "too many arguments");
+		for (uint32_t i = 0; i < arg_count; ++i) lua_pushstring(L, args[i]);
+		status = lua_pcall(L, (int)arg_count, 1, 1);
+	}
+	if (status == LUA_OK) ret = lua_isboolean(L, -1) && !lua_toboolean(L, -1);
+	else
+	{
+		lp_w_str(out, "error: "); lp_w_str(out, lua_tostring(L, -1)); lp_w_putc(out, '\n');
+		ret = 1;
+	}
+	lua_close(L);
+	return ret;
+}